@@ -2,25 +2,30 @@
 
 out vec4 FragColor;
 in vec4 vCol;
-in vec2 vUV;
-uniform sampler2D uTexture;
-uniform int uWireframe;
-uniform int uBillboard;
+in vec3 vUV;
+uniform sampler2DArray uTexture;
+layout (std140) uniform Frame
+{
+    mat4 uViewProjection;
+    int uRenderMode;
+    float uBillboardYaw;
+};
+flat in int vBillboard;
 
 void main()
 {
-    if (uWireframe == 1) {
+    if (uRenderMode == 1) {
         FragColor = vec4(0, 1, 1, 1);
     } else {
         vec4 vertCol = vec4(1,1,1,1);
         vec4 texCol = vec4(1,1,1,1);
-        if ((uWireframe & 2) == 2)
+        if ((uRenderMode & 2) == 2)
         {
             vertCol = 2 * vec4(vCol.rgba);
         }
-        if ((uWireframe & 4) == 4)
+        if ((uRenderMode & 4) == 4)
         {
-            texCol = texture2D(uTexture, vUV);
+            texCol = texture(uTexture, vUV);
         }
         
 
@@ -30,7 +35,7 @@ void main()
             discard;
         }
 
-        //if (uBillboard == 1)
+        //if (vBillboard == 1)
         //{
         //    if (FragColor.r < 0.1 && FragColor.g < 0.1 && FragColor.b < 0.1)
         //    {
@@ -1,20 +1,35 @@
 #version 330 core
 
-layout (location = 0) in vec3 aPos;
+// Position in .dfx units with the atlas page in w
+layout (location = 0) in vec4 aPos;
 layout (location = 1) in vec4 aColor;
 layout (location = 2) in vec2 aUV;
 //layout (location = 2) in vec3 aNormal;
+// Per instance: world position and yaw, and 1 for billboards
+layout (location = 3) in vec4 aInstance;
+layout (location = 4) in float aBillboard;
 
-uniform mat4 uCamera;
+layout (std140) uniform Frame
+{
+    mat4 uViewProjection;
+    int uRenderMode;
+    float uBillboardYaw;
+};
 
 out vec4 vCol;
-out vec2 vUV;
+out vec3 vUV;
+flat out int vBillboard;
 
 void main()
 {
-    gl_Position = (uCamera * vec4(aPos.xyz, 1.0));
+    bool billboard = aBillboard > 0.5 && (uRenderMode & 8) == 8;
+    float yaw = billboard ? uBillboardYaw : aInstance.w;
+    vec3 pos = aPos.xyz * 0.001;
+    pos = vec3(cos(yaw) * pos.x + sin(yaw) * pos.z, pos.y, cos(yaw) * pos.z - sin(yaw) * pos.x);
+    gl_Position = (uViewProjection * vec4(pos + aInstance.xyz, 1.0));
     //vec3 cPos = vec3(uCamera[0][3], uCamera[1][3], uCamera[2][3]);
     //cPos = cPos - gl_Position.xyz;
     vCol = aColor;
-    vUV = aUV;
+    vUV = vec3(aUV, aPos.w);
+    vBillboard = billboard ? 1 : 0;
 }
\ No newline at end of file
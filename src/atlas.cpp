@@ -0,0 +1,117 @@
+#include "atlas.h"
+#include <cstring>
+
+size_t GetAtlasTexelCount(unsigned int w, unsigned int h, unsigned int levels, unsigned int pages)
+{
+	size_t count = 0;
+	for (unsigned int mip = 0; mip < levels; ++mip)
+		count += (size_t)GetMipSize(w, mip) * GetMipSize(h, mip);
+	return count * pages;
+}
+
+texture_t GetAtlasLevel(const texture_t& sheet, unsigned int mip, unsigned int pages)
+{
+	return { GetMipSize(sheet.w, mip), GetMipSize(sheet.h, mip) * pages, sheet.pixels + GetAtlasTexelCount(sheet.w, sheet.h, mip, pages) };
+}
+
+bool IsOpaque(const texture_t& image)
+{
+	const size_t count = (size_t)image.w * image.h;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (image.pixels[i].a != 255)
+			return false;
+	}
+	return true;
+}
+
+static inline rgba8_t Average(rgba8_t a, rgba8_t b, rgba8_t c, rgba8_t d)
+{
+	return {
+		(unsigned char)((a.r + b.r + c.r + d.r + 2) >> 2),
+		(unsigned char)((a.g + b.g + c.g + d.g + 2) >> 2),
+		(unsigned char)((a.b + b.b + c.b + d.b + 2) >> 2),
+		(unsigned char)((a.a + b.a + c.a + d.a + 2) >> 2)
+	};
+}
+
+// Odd edges of 1-texel-wide sources repeat their last texel
+static void DownsampleRowScalar(const texture_t& src, const rgba8_t* rowA, const rgba8_t* rowB, rgba8_t* out, unsigned int first, unsigned int count)
+{
+	for (unsigned int x = first; x < first + count; ++x)
+	{
+		const unsigned int x0 = x * 2;
+		const unsigned int x1 = std::min(x0 + 1, src.w - 1);
+		out[x] = Average(rowA[x0], rowA[x1], rowB[x0], rowB[x1]);
+	}
+}
+
+#ifdef G2_SIMD_X86
+// Horizontal pair sums of eight texels as 16-bit channels, pairs 0-1 in `lo`
+G2_TARGET_SSE2
+static inline void SumPairs(const rgba8_t* row, __m128i& lo, __m128i& hi)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)row));
+	const __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(row + 4)));
+	const __m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+	const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	lo = _mm_add_epi16(_mm_unpacklo_epi8(even, zero), _mm_unpacklo_epi8(odd, zero));
+	hi = _mm_add_epi16(_mm_unpackhi_epi8(even, zero), _mm_unpackhi_epi8(odd, zero));
+}
+
+// Four output texels from eight texels of each source row
+G2_TARGET_SSE2
+static unsigned int DownsampleRowSSE2(const rgba8_t* rowA, const rgba8_t* rowB, rgba8_t* out, unsigned int count)
+{
+	const __m128i round = _mm_set1_epi16(2);
+	unsigned int x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i aLo, aHi, bLo, bHi;
+		SumPairs(rowA + x * 2, aLo, aHi);
+		SumPairs(rowB + x * 2, bLo, bHi);
+		const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(aLo, bLo), round), 2);
+		const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(aHi, bHi), round), 2);
+		_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+	}
+	return x;
+}
+#endif
+
+void DownsampleRows(const texture_t& src, texture_t& dst, unsigned int firstRow, unsigned int rowCount, Simd::Level_t level)
+{
+	for (unsigned int y = firstRow; y < firstRow + rowCount; ++y)
+	{
+		const rgba8_t* rowA = src.pixels + (size_t)(y * 2) * src.w;
+		const rgba8_t* rowB = src.pixels + (size_t)std::min(y * 2 + 1, src.h - 1) * src.w;
+		rgba8_t* out = dst.pixels + (size_t)y * dst.w;
+
+		unsigned int done = 0;
+#ifdef G2_SIMD_X86
+		// Whole texel pairs only, a 1-texel-wide source takes the scalar path
+		if (level != Simd::Level_t::Scalar && src.w >= 2)
+			done = DownsampleRowSSE2(rowA, rowB, out, src.w / 2);
+#endif
+		DownsampleRowScalar(src, rowA, rowB, out, done, dst.w - done);
+	}
+}
+
+void ExtendGutter(texture_t& dst, int x, int y, unsigned int w, unsigned int h, int gutter)
+{
+	for (unsigned int row = 0; row < h; ++row)
+	{
+		rgba8_t* line = dst.pixels + (size_t)(y + row) * dst.w + x;
+		std::fill(line - gutter, line, line[0]);
+		std::fill(line + w, line + w + gutter, line[w - 1]);
+	}
+
+	const size_t span = (w + gutter * 2) * sizeof(rgba8_t);
+	const rgba8_t* top = dst.pixels + (size_t)y * dst.w + x - gutter;
+	const rgba8_t* bottom = top + (size_t)(h - 1) * dst.w;
+	for (int row = 1; row <= gutter; ++row)
+	{
+		memcpy(dst.pixels + (size_t)(y - row) * dst.w + x - gutter, top, span);
+		memcpy(dst.pixels + (size_t)(y + h - 1 + row) * dst.w + x - gutter, bottom, span);
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "mapreader.h"
+#include "simd.h"
+#include <algorithm>
+
+// The atlas keeps its mip levels one after another in sheet.pixels, and each
+// level holds every page one under the other. A level is then a single
+// w x (h * pages) image, in the layer order glTexImage3D takes, and an image
+// on page p starts at row p * h + y of level 0. Packed images sit inside a
+// gutter of repeated edge texels that is still one texel wide at the
+// smallest level, so filtering never reaches a neighbouring image.
+constexpr unsigned int c_ATLASMIPLEVELS = 4;
+constexpr int c_ATLASGUTTER = 1 << (c_ATLASMIPLEVELS - 1);
+
+inline unsigned int GetMipSize(unsigned int size, unsigned int mip)
+{
+	return std::max(1u, size >> mip);
+}
+
+// `w` and `h` are the size of one page
+size_t GetAtlasTexelCount(unsigned int w, unsigned int h, unsigned int levels, unsigned int pages = 1);
+// View of level `mip` of an atlas stored as above, all pages included
+texture_t GetAtlasLevel(const texture_t& sheet, unsigned int mip, unsigned int pages = 1);
+
+// Whether every texel of the image has full alpha
+bool IsOpaque(const texture_t& image);
+
+// Fills rows [firstRow, firstRow + rowCount) of `dst` with the 2x2 box filter
+// of `src`, rounded to nearest. `dst` is GetMipSize of `src` in both axes.
+void DownsampleRows(const texture_t& src, texture_t& dst, unsigned int firstRow, unsigned int rowCount, Simd::Level_t level = Simd::GetLevel());
+
+// Repeats the edge texels of the w x h image at (x, y) `gutter` texels outwards
+void ExtendGutter(texture_t& dst, int x, int y, unsigned int w, unsigned int h, int gutter);
@@ -0,0 +1,425 @@
+#include "blockcompress.h"
+#include "atlas.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using u16 = unsigned short;
+using u32 = unsigned int;
+using u64 = unsigned long long;
+
+const char* GetBlockFormatName(BlockFormat_t format)
+{
+	switch (format)
+	{
+	case BlockFormat_t::None: return "RGBA8";
+	case BlockFormat_t::BC1: return "BC1";
+	case BlockFormat_t::BC3: return "BC3";
+	}
+	return "";
+}
+
+size_t GetBlockBytes(BlockFormat_t format)
+{
+	switch (format)
+	{
+	case BlockFormat_t::BC1: return 8;
+	case BlockFormat_t::BC3: return 16;
+	default: return 0;
+	}
+}
+
+size_t GetCompressedSize(unsigned int w, unsigned int h, BlockFormat_t format)
+{
+	return (size_t)((w + 3) / 4) * ((h + 3) / 4) * GetBlockBytes(format);
+}
+
+static void UnpackRGB565(u16 v, int out[3])
+{
+	const int r = v >> 11, g = (v >> 5) & 0x3F, b = v & 0x1F;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+static u16 PackRGB565(const float c[3])
+{
+	auto quantize = [](float v, int max) { return (int)std::lround(std::clamp(v, 0.f, 255.f) * max / 255.f); };
+	return (u16)((quantize(c[0], 31) << 11) | (quantize(c[1], 63) << 5) | quantize(c[2], 31));
+}
+
+// The four colours a decoder derives from the endpoints, in four colour mode
+// when c0 > c1 and three colour mode plus transparent black otherwise
+static void BuildColourPalette(u16 c0, u16 c1, int palette[4][4])
+{
+	UnpackRGB565(c0, palette[0]);
+	UnpackRGB565(c1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	for (int c = 0; c < 3; ++c)
+	{
+		if (c0 > c1)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[3][3] = c0 > c1 ? 255 : 0;
+}
+
+// Nearest palette entry for every texel, returns the total squared error
+static u64 PickColourIndices(const rgba8_t* block, u16 c0, u16 c1, u32& indices)
+{
+	int palette[4][4];
+	BuildColourPalette(c0, c1, palette);
+
+	u64 error = 0;
+	indices = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int best = 0, bestError = INT_MAX;
+		for (int p = 0; p < (c0 > c1 ? 4 : 3); ++p)
+		{
+			const int dr = block[i].r - palette[p][0], dg = block[i].g - palette[p][1], db = block[i].b - palette[p][2];
+			const int e = dr * dr + dg * dg + db * db;
+			if (e < bestError)
+			{
+				bestError = e;
+				best = p;
+			}
+		}
+		indices |= (u32)best << (i * 2);
+		error += bestError;
+	}
+	return error;
+}
+
+// Endpoint order that keeps the block in four colour mode when the endpoints differ
+static void OrderEndpoints(u16& c0, u16& c1)
+{
+	if (c0 < c1)
+		std::swap(c0, c1);
+}
+
+void EncodeBC1Block(const rgba8_t* block, unsigned char* out)
+{
+	float mean[3] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		mean[0] += block[i].r;
+		mean[1] += block[i].g;
+		mean[2] += block[i].b;
+	}
+	for (float& m : mean)
+		m /= 16.f;
+
+	// Covariance xx, xy, xz, yy, yz, zz
+	float cov[6] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		const float d[3] = { block[i].r - mean[0], block[i].g - mean[1], block[i].b - mean[2] };
+		cov[0] += d[0] * d[0];
+		cov[1] += d[0] * d[1];
+		cov[2] += d[0] * d[2];
+		cov[3] += d[1] * d[1];
+		cov[4] += d[1] * d[2];
+		cov[5] += d[2] * d[2];
+	}
+
+	// Endpoints at the extremes of the colours along their principal axis,
+	// found by power iteration
+	float axis[3] = { 1.f, 1.f, 1.f };
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		const float next[3] = {
+			cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+			cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+			cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+		};
+		const float length = std::max({ std::fabs(next[0]), std::fabs(next[1]), std::fabs(next[2]) });
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < 3; ++c)
+			axis[c] = next[c] / length;
+	}
+
+	float minProj = 0.f, maxProj = 0.f;
+	for (int i = 0; i < 16; ++i)
+	{
+		const float proj = (block[i].r - mean[0]) * axis[0] + (block[i].g - mean[1]) * axis[1] + (block[i].b - mean[2]) * axis[2];
+		minProj = std::min(minProj, proj);
+		maxProj = std::max(maxProj, proj);
+	}
+
+	const float axisLength2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float e0[3], e1[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		e0[c] = mean[c] + axis[c] * maxProj / axisLength2;
+		e1[c] = mean[c] + axis[c] * minProj / axisLength2;
+	}
+
+	u16 c0 = PackRGB565(e0), c1 = PackRGB565(e1);
+	OrderEndpoints(c0, c1);
+	u32 indices;
+	u64 error = PickColourIndices(block, c0, c1, indices);
+
+	// One least squares pass over the endpoints for the chosen indices
+	if (c0 != c1)
+	{
+		constexpr float c_WEIGHTS[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+		float a = 0, b = 0, ab = 0, x[3] = {}, y[3] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			const float w = c_WEIGHTS[(indices >> (i * 2)) & 3];
+			const float rgb[3] = { (float)block[i].r, (float)block[i].g, (float)block[i].b };
+			a += w * w;
+			b += (1 - w) * (1 - w);
+			ab += w * (1 - w);
+			for (int c = 0; c < 3; ++c)
+			{
+				x[c] += w * rgb[c];
+				y[c] += (1 - w) * rgb[c];
+			}
+		}
+
+		const float det = a * b - ab * ab;
+		if (std::fabs(det) > 1e-6f)
+		{
+			float r0[3], r1[3];
+			for (int c = 0; c < 3; ++c)
+			{
+				r0[c] = (b * x[c] - ab * y[c]) / det;
+				r1[c] = (a * y[c] - ab * x[c]) / det;
+			}
+
+			u16 refined0 = PackRGB565(r0), refined1 = PackRGB565(r1);
+			OrderEndpoints(refined0, refined1);
+			u32 refinedIndices;
+			const u64 refinedError = PickColourIndices(block, refined0, refined1, refinedIndices);
+			if (refinedError < error)
+			{
+				c0 = refined0;
+				c1 = refined1;
+				indices = refinedIndices;
+				error = refinedError;
+			}
+		}
+	}
+
+	out[0] = (unsigned char)c0;
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)c1;
+	out[3] = (unsigned char)(c1 >> 8);
+	for (int i = 0; i < 4; ++i)
+		out[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+static void BuildAlphaPalette(int a0, int a1, int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1)
+	{
+		for (int i = 2; i < 8; ++i)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	}
+	else
+	{
+		for (int i = 2; i < 6; ++i)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+void EncodeBC3Block(const rgba8_t* block, unsigned char* out)
+{
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; ++i)
+	{
+		a0 = std::max<int>(a0, block[i].a);
+		a1 = std::min<int>(a1, block[i].a);
+	}
+
+	// Eight interpolated values between the extremes, a flat block keeps index 0
+	u64 indices = 0;
+	if (a0 != a1)
+	{
+		int palette[8];
+		BuildAlphaPalette(a0, a1, palette);
+		for (int i = 0; i < 16; ++i)
+		{
+			int best = 0, bestError = INT_MAX;
+			for (int p = 0; p < 8; ++p)
+			{
+				const int e = std::abs(block[i].a - palette[p]);
+				if (e < bestError)
+				{
+					bestError = e;
+					best = p;
+				}
+			}
+			indices |= (u64)best << (i * 3);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = (unsigned char)(indices >> (i * 8));
+	EncodeBC1Block(block, out + 8);
+}
+
+static void DecodeColourBlock(const unsigned char* in, bool forceFourColour, rgba8_t* block)
+{
+	const u16 c0 = (u16)(in[0] | (in[1] << 8));
+	const u16 c1 = (u16)(in[2] | (in[3] << 8));
+	int palette[4][4];
+	// BC3 colour blocks always use four colours
+	if (forceFourColour && c0 <= c1)
+	{
+		UnpackRGB565(c0, palette[0]);
+		UnpackRGB565(c1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	}
+	else
+		BuildColourPalette(c0, c1, palette);
+
+	const u32 indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((u32)in[7] << 24);
+	for (int i = 0; i < 16; ++i)
+	{
+		const int* p = palette[(indices >> (i * 2)) & 3];
+		block[i] = { (unsigned char)p[0], (unsigned char)p[1], (unsigned char)p[2], (unsigned char)p[3] };
+	}
+}
+
+void DecodeBC1Block(const unsigned char* in, rgba8_t* block)
+{
+	DecodeColourBlock(in, false, block);
+}
+
+void DecodeBC3Block(const unsigned char* in, rgba8_t* block)
+{
+	DecodeColourBlock(in + 8, true, block);
+
+	int palette[8];
+	BuildAlphaPalette(in[0], in[1], palette);
+	u64 indices = 0;
+	for (int i = 0; i < 6; ++i)
+		indices |= (u64)in[2 + i] << (i * 8);
+	for (int i = 0; i < 16; ++i)
+		block[i].a = (unsigned char)palette[(indices >> (i * 3)) & 7];
+}
+
+void CompressBlockRows(const texture_t& src, BlockFormat_t format, unsigned int firstBlockRow, unsigned int blockRowCount, unsigned char* out)
+{
+	const unsigned int blocksWide = (src.w + 3) / 4;
+	const size_t blockBytes = GetBlockBytes(format);
+	rgba8_t block[16];
+	for (unsigned int by = firstBlockRow; by < firstBlockRow + blockRowCount; ++by)
+	{
+		for (unsigned int bx = 0; bx < blocksWide; ++bx)
+		{
+			for (unsigned int y = 0; y < 4; ++y)
+			{
+				const rgba8_t* row = src.pixels + (size_t)std::min(by * 4 + y, src.h - 1) * src.w;
+				for (unsigned int x = 0; x < 4; ++x)
+					block[y * 4 + x] = row[std::min(bx * 4 + x, src.w - 1)];
+			}
+
+			unsigned char* dst = out + ((size_t)by * blocksWide + bx) * blockBytes;
+			if (format == BlockFormat_t::BC3)
+				EncodeBC3Block(block, dst);
+			else
+				EncodeBC1Block(block, dst);
+		}
+	}
+}
+
+void DecompressImage(const unsigned char* src, BlockFormat_t format, texture_t& dst)
+{
+	const unsigned int blocksWide = (dst.w + 3) / 4;
+	const unsigned int blocksHigh = (dst.h + 3) / 4;
+	const size_t blockBytes = GetBlockBytes(format);
+	rgba8_t block[16];
+	for (unsigned int by = 0; by < blocksHigh; ++by)
+	{
+		for (unsigned int bx = 0; bx < blocksWide; ++bx)
+		{
+			const unsigned char* in = src + ((size_t)by * blocksWide + bx) * blockBytes;
+			if (format == BlockFormat_t::BC3)
+				DecodeBC3Block(in, block);
+			else
+				DecodeBC1Block(in, block);
+
+			for (unsigned int y = 0; y < 4 && by * 4 + y < dst.h; ++y)
+				for (unsigned int x = 0; x < 4 && bx * 4 + x < dst.w; ++x)
+					dst.pixels[(size_t)(by * 4 + y) * dst.w + bx * 4 + x] = block[y * 4 + x];
+		}
+	}
+}
+
+BlockFormat_t ChooseAtlasBlockFormat(const texture_t& sheet, unsigned int pages)
+{
+	return IsOpaque(GetAtlasLevel(sheet, 0, pages)) ? BlockFormat_t::BC1 : BlockFormat_t::BC3;
+}
+
+size_t GetCompressedAtlasSize(unsigned int w, unsigned int h, unsigned int levels, unsigned int pages, BlockFormat_t format)
+{
+	return GetCompressedAtlasOffset(w, h, levels, 0, pages, format);
+}
+
+size_t GetCompressedAtlasOffset(unsigned int w, unsigned int h, unsigned int mip, unsigned int page, unsigned int pages, BlockFormat_t format)
+{
+	size_t offset = 0;
+	for (unsigned int m = 0; m < mip; ++m)
+		offset += GetCompressedSize(GetMipSize(w, m), GetMipSize(h, m), format) * pages;
+	return offset + GetCompressedSize(GetMipSize(w, mip), GetMipSize(h, mip), format) * page;
+}
+
+// Blocks per work item
+constexpr unsigned int c_COMPRESSBANDBLOCKS = 4096;
+
+void CompressAtlas(const texture_t& sheet, unsigned int levels, unsigned int pages, BlockFormat_t format, unsigned char* out, ThreadPool& pool)
+{
+	struct band_t
+	{
+		texture_t page;
+		unsigned char* out;
+		unsigned int firstBlockRow;
+		unsigned int blockRowCount;
+	};
+	std::vector<band_t> bands;
+	for (unsigned int mip = 0; mip < levels; ++mip)
+	{
+		const texture_t level = GetAtlasLevel(sheet, mip, pages);
+		const unsigned int w = GetMipSize(sheet.w, mip), h = GetMipSize(sheet.h, mip);
+		const unsigned int blocksWide = (w + 3) / 4, blocksHigh = (h + 3) / 4;
+		const unsigned int bandRows = std::max(1u, c_COMPRESSBANDBLOCKS / blocksWide);
+		for (unsigned int page = 0; page < pages; ++page)
+		{
+			const texture_t pageTexture = { w, h, level.pixels + (size_t)page * w * h };
+			unsigned char* pageOut = out + GetCompressedAtlasOffset(sheet.w, sheet.h, mip, page, pages, format);
+			for (unsigned int row = 0; row < blocksHigh; row += bandRows)
+				bands.push_back({ pageTexture, pageOut, row, std::min(bandRows, blocksHigh - row) });
+		}
+	}
+
+	pool.ParallelFor(bands.size(), [&](size_t i)
+		{
+			CompressBlockRows(bands[i].page, format, bands[i].firstBlockRow, bands[i].blockRowCount, bands[i].out);
+		});
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+
+struct rgba8_t;
+struct texture_t;
+class ThreadPool;
+
+// S3TC block compression of the atlas for upload as compressed GL textures.
+// Every 4x4 texel block encodes on its own, so the output does not depend on
+// how the work is split between threads.
+enum class BlockFormat_t : unsigned int
+{
+	None,
+	BC1, // DXT1, opaque RGB in 8 bytes a block
+	BC3  // DXT5, RGB as BC1 plus 8 bytes of interpolated alpha
+};
+
+const char* GetBlockFormatName(BlockFormat_t format);
+size_t GetBlockBytes(BlockFormat_t format);
+// Partial blocks at the right and bottom edges count as whole ones
+size_t GetCompressedSize(unsigned int w, unsigned int h, BlockFormat_t format);
+
+// `block` holds the 16 texels in row order
+void EncodeBC1Block(const rgba8_t* block, unsigned char* out);
+void EncodeBC3Block(const rgba8_t* block, unsigned char* out);
+void DecodeBC1Block(const unsigned char* in, rgba8_t* block);
+void DecodeBC3Block(const unsigned char* in, rgba8_t* block);
+
+// Encodes block rows [firstBlockRow, firstBlockRow + blockRowCount) of `src`
+// into `out`, which points at the start of the compressed image. Edge blocks
+// repeat the last row and column.
+void CompressBlockRows(const texture_t& src, BlockFormat_t format, unsigned int firstBlockRow, unsigned int blockRowCount, unsigned char* out);
+// Fills `dst`, which has the size of the compressed image, from `src`
+void DecompressImage(const unsigned char* src, BlockFormat_t format, texture_t& dst);
+
+// BC3 if any level 0 texel is not fully opaque, BC1 otherwise
+BlockFormat_t ChooseAtlasBlockFormat(const texture_t& sheet, unsigned int pages);
+// Compressed atlases keep the sheet's order, levels one after another and
+// each page of a level compressed as its own image
+size_t GetCompressedAtlasSize(unsigned int w, unsigned int h, unsigned int levels, unsigned int pages, BlockFormat_t format);
+size_t GetCompressedAtlasOffset(unsigned int w, unsigned int h, unsigned int mip, unsigned int page, unsigned int pages, BlockFormat_t format);
+// Compresses every level and page of the sheet on `pool` into `out`, which
+// holds GetCompressedAtlasSize bytes
+void CompressAtlas(const texture_t& sheet, unsigned int levels, unsigned int pages, BlockFormat_t format, unsigned char* out, ThreadPool& pool);
@@ -0,0 +1,118 @@
+#include "filereader.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct filemapping_t
+{
+	const file_t::data_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+
+	~filemapping_t()
+	{
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+#else
+	~filemapping_t()
+	{
+		if (data)
+			munmap((void*)data, size);
+	}
+#endif
+};
+
+static std::shared_ptr<filemapping_t> MapFile(const std::string& filepath)
+{
+	auto mapping = std::make_shared<filemapping_t>();
+#ifdef _WIN32
+	mapping->file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapping->file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapping->file, &size) || size.QuadPart == 0)
+		return nullptr;
+
+	mapping->mapping = CreateFileMappingA(mapping->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping->mapping)
+		return nullptr;
+
+	mapping->data = (const file_t::data_t*)MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mapping->data)
+		return nullptr;
+	mapping->size = (size_t)size.QuadPart;
+#else
+	int fd = open(filepath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	mapping->data = (const file_t::data_t*)data;
+	mapping->size = (size_t)st.st_size;
+#endif
+	return mapping;
+}
+
+static bool ReadFileCopy(const std::string& filepath, file_t& file)
+{
+	if (FILE* f = fopen(filepath.c_str(), "rb"))
+	{
+		fseek(f, 0, SEEK_END);
+		size_t size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		std::shared_ptr<file_t::data_t[]> buffer(new file_t::data_t[size]);
+		size = fread(buffer.get(), 1, size, f);
+		fclose(f);
+		file.data = { buffer.get(), size };
+		file.backing = std::move(buffer);
+		return true;
+	}
+
+	return false;
+}
+
+bool ReadFile(const std::string& filepath, file_t& file, FileBackend_t backend)
+{
+	file.data = {};
+	file.backing.reset();
+	file.baseOffset = 0;
+
+	if (backend == FileBackend_t::Mapped)
+	{
+		if (auto mapping = MapFile(filepath))
+		{
+			file.data = { mapping->data, mapping->size };
+			file.backing = std::move(mapping);
+			return true;
+		}
+	}
+
+	return ReadFileCopy(filepath, file);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+
+enum class FileBackend_t
+{
+	Mapped, // Read-only memory map, falls back to Copied if mapping fails
+	Copied  // Whole file read into a heap buffer
+};
+
+struct file_t
+{
+	using data_t = unsigned char;
+
+	// View of the file contents. Owned by `backing`, which is shared between
+	// copies so several cursors can walk the same file independently.
+	std::span<const data_t> data;
+	std::shared_ptr<const void> backing;
+	unsigned int baseOffset = 0;
+
+	size_t size() const { return data.size(); }
+
+	template<typename T>
+	T Read(size_t offset, bool moveOffset = false)
+	{
+		T data = _Read<T>(baseOffset + offset);
+		if constexpr (std::endian::native == std::endian::big && sizeof(T) > 1)
+		{
+			using byte = unsigned char;
+			for (int i = 0; i < sizeof(T) >> 1; ++i)
+			{
+				static_cast<byte*>(&data)[i] ^= static_cast<byte*>(&data)[sizeof(T) - i - 1];
+				static_cast<byte*>(&data)[sizeof(T) - i - 1] ^= static_cast<byte*>(&data)[i];
+				static_cast<byte*>(&data)[i] ^= static_cast<byte*>(&data)[sizeof(T) - i - 1];
+			}
+		}
+		if (moveOffset)
+			baseOffset += sizeof(T) + offset;
+		return data;
+	}
+
+private:
+
+	template<typename T>
+	T _Read(size_t offset) const
+	{
+#ifdef DEBUG
+		if (offset >= size())
+		{
+			printf("READ OUT OF BOUNDS! %zx >= %zx!\n", offset, size());
+		}
+#endif
+		T value;
+		memcpy(&value, data.data() + offset, sizeof(T));
+		return value;
+	}
+};
+
+bool ReadFile(const std::string& filepath, file_t& file, FileBackend_t backend = FileBackend_t::Mapped);
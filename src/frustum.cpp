@@ -0,0 +1,141 @@
+#include "frustum.h"
+#include <bit>
+#include <cmath>
+
+frustum_t ExtractFrustum(const float* viewProjection)
+{
+	// Row r of the matrix is m[r], m[4 + r], m[8 + r], m[12 + r]
+	auto row = [viewProjection](int r, int i) { return viewProjection[i * 4 + r]; };
+	frustum_t frustum;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			frustum.planes[axis * 2][i] = row(3, i) + row(axis, i);
+			frustum.planes[axis * 2 + 1][i] = row(3, i) - row(axis, i);
+		}
+	}
+	return frustum;
+}
+
+void cullboxes_t::clear()
+{
+	for (auto* v : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		v->clear();
+}
+
+void cullboxes_t::push_back(const float center[3], const float extent[3])
+{
+	centerX.push_back(center[0]);
+	centerY.push_back(center[1]);
+	centerZ.push_back(center[2]);
+	extentX.push_back(extent[0]);
+	extentY.push_back(extent[1]);
+	extentZ.push_back(extent[2]);
+}
+
+// A box is outside when its centre is further behind a plane than its
+// extents reach. Every path adds in the same order, so they agree exactly.
+static size_t CullScalar(const frustum_t& frustum, const cullboxes_t& boxes, size_t first, unsigned char* visible)
+{
+	size_t count = 0;
+	for (size_t i = first; i < boxes.size(); ++i)
+	{
+		bool outside = false;
+		for (const auto& p : frustum.planes)
+		{
+			const float distance = p[0] * boxes.centerX[i] + p[1] * boxes.centerY[i] + p[2] * boxes.centerZ[i] + p[3];
+			const float radius = std::abs(p[0]) * boxes.extentX[i] + std::abs(p[1]) * boxes.extentY[i] + std::abs(p[2]) * boxes.extentZ[i];
+			outside = outside || distance + radius < 0.f;
+		}
+		visible[i] = outside ? 0 : 1;
+		count += visible[i];
+	}
+	return count;
+}
+
+#ifdef G2_SIMD_X86
+G2_TARGET_SSE2
+static size_t CullSSE2(const frustum_t& frustum, const cullboxes_t& boxes, size_t first, unsigned char* visible, size_t& count)
+{
+	__m128 planes[6][4], extents[6][3];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int i = 0; i < 4; ++i)
+			planes[p][i] = _mm_set1_ps(frustum.planes[p][i]);
+		for (int i = 0; i < 3; ++i)
+			extents[p][i] = _mm_set1_ps(std::abs(frustum.planes[p][i]));
+	}
+
+	const size_t end = first + (boxes.size() - first) / 4 * 4;
+	for (size_t i = first; i < end; i += 4)
+	{
+		const __m128 cx = _mm_loadu_ps(boxes.centerX.data() + i);
+		const __m128 cy = _mm_loadu_ps(boxes.centerY.data() + i);
+		const __m128 cz = _mm_loadu_ps(boxes.centerZ.data() + i);
+		const __m128 ex = _mm_loadu_ps(boxes.extentX.data() + i);
+		const __m128 ey = _mm_loadu_ps(boxes.extentY.data() + i);
+		const __m128 ez = _mm_loadu_ps(boxes.extentZ.data() + i);
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], cx), _mm_mul_ps(planes[p][1], cy)), _mm_mul_ps(planes[p][2], cz)), planes[p][3]);
+			const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extents[p][0], ex), _mm_mul_ps(extents[p][1], ey)), _mm_mul_ps(extents[p][2], ez));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		const unsigned int mask = ~(unsigned int)_mm_movemask_ps(outside) & 0xF;
+		for (int k = 0; k < 4; ++k)
+			visible[i + k] = (mask >> k) & 1;
+		count += std::popcount(mask);
+	}
+	return end;
+}
+
+G2_TARGET_AVX2
+static size_t CullAVX2(const frustum_t& frustum, const cullboxes_t& boxes, unsigned char* visible, size_t& count)
+{
+	__m256 planes[6][4], extents[6][3];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int i = 0; i < 4; ++i)
+			planes[p][i] = _mm256_set1_ps(frustum.planes[p][i]);
+		for (int i = 0; i < 3; ++i)
+			extents[p][i] = _mm256_set1_ps(std::abs(frustum.planes[p][i]));
+	}
+
+	const size_t end = boxes.size() / 8 * 8;
+	for (size_t i = 0; i < end; i += 8)
+	{
+		const __m256 cx = _mm256_loadu_ps(boxes.centerX.data() + i);
+		const __m256 cy = _mm256_loadu_ps(boxes.centerY.data() + i);
+		const __m256 cz = _mm256_loadu_ps(boxes.centerZ.data() + i);
+		const __m256 ex = _mm256_loadu_ps(boxes.extentX.data() + i);
+		const __m256 ey = _mm256_loadu_ps(boxes.extentY.data() + i);
+		const __m256 ez = _mm256_loadu_ps(boxes.extentZ.data() + i);
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planes[p][0], cx), _mm256_mul_ps(planes[p][1], cy)), _mm256_mul_ps(planes[p][2], cz)), planes[p][3]);
+			const __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extents[p][0], ex), _mm256_mul_ps(extents[p][1], ey)), _mm256_mul_ps(extents[p][2], ez));
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+		const unsigned int mask = ~(unsigned int)_mm256_movemask_ps(outside) & 0xFF;
+		for (int k = 0; k < 8; ++k)
+			visible[i + k] = (mask >> k) & 1;
+		count += std::popcount(mask);
+	}
+	return end;
+}
+#endif
+
+size_t CullBoxes(const frustum_t& frustum, const cullboxes_t& boxes, unsigned char* visible, Simd::Level_t level)
+{
+	size_t done = 0, count = 0;
+#ifdef G2_SIMD_X86
+	if (level == Simd::Level_t::AVX2)
+		done = CullAVX2(frustum, boxes, visible, count);
+	if (level != Simd::Level_t::Scalar)
+		done = CullSSE2(frustum, boxes, done, visible, count);
+#endif
+	return count + CullScalar(frustum, boxes, done, visible);
+}
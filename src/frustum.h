@@ -0,0 +1,30 @@
+#pragma once
+#include "simd.h"
+#include <cstddef>
+#include <vector>
+
+// Six planes, a * x + b * y + c * z + d >= 0 inside each
+struct frustum_t
+{
+	float planes[6][4];
+};
+
+// Of a column-major view-projection matrix, the way glm stores one
+frustum_t ExtractFrustum(const float* viewProjection);
+
+// World space boxes as centres and half extents, one array per component so
+// they are tested several at a time
+struct cullboxes_t
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+
+	size_t size() const { return centerX.size(); }
+	void clear();
+	void push_back(const float center[3], const float extent[3]);
+};
+
+// Sets visible[i] to 1 when box i intersects the frustum or is too close to
+// call and to 0 when it is outside a plane. Returns the visible count. The
+// SIMD paths give the same result as Simd::Level_t::Scalar.
+size_t CullBoxes(const frustum_t& frustum, const cullboxes_t& boxes, unsigned char* visible, Simd::Level_t level = Simd::GetLevel());
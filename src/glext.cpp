@@ -0,0 +1,52 @@
+#include "glext.h"
+#include <cstddef>
+
+#ifndef GL_VERSION_3_0
+PFNGLBINDVERTEXARRAYPROC glad_glBindVertexArray = NULL;
+PFNGLDELETEVERTEXARRAYSPROC glad_glDeleteVertexArrays = NULL;
+PFNGLGENVERTEXARRAYSPROC glad_glGenVertexArrays = NULL;
+PFNGLBINDBUFFERBASEPROC glad_glBindBufferBase = NULL;
+#endif
+
+#ifndef GL_VERSION_3_1
+PFNGLGETUNIFORMBLOCKINDEXPROC glad_glGetUniformBlockIndex = NULL;
+PFNGLUNIFORMBLOCKBINDINGPROC glad_glUniformBlockBinding = NULL;
+#endif
+
+#ifndef GL_VERSION_3_2
+PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC glad_glDrawElementsInstancedBaseVertex = NULL;
+#endif
+
+#ifndef GL_VERSION_3_3
+PFNGLVERTEXATTRIBDIVISORPROC glad_glVertexAttribDivisor = NULL;
+#endif
+
+#ifndef GL_VERSION_4_3
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect = NULL;
+#endif
+
+bool LoadGLExtensions(GLADloadproc load)
+{
+#ifndef GL_VERSION_3_0
+	glad_glBindVertexArray = (PFNGLBINDVERTEXARRAYPROC)load("glBindVertexArray");
+	glad_glDeleteVertexArrays = (PFNGLDELETEVERTEXARRAYSPROC)load("glDeleteVertexArrays");
+	glad_glGenVertexArrays = (PFNGLGENVERTEXARRAYSPROC)load("glGenVertexArrays");
+	glad_glBindBufferBase = (PFNGLBINDBUFFERBASEPROC)load("glBindBufferBase");
+#endif
+#ifndef GL_VERSION_3_1
+	glad_glGetUniformBlockIndex = (PFNGLGETUNIFORMBLOCKINDEXPROC)load("glGetUniformBlockIndex");
+	glad_glUniformBlockBinding = (PFNGLUNIFORMBLOCKBINDINGPROC)load("glUniformBlockBinding");
+#endif
+#ifndef GL_VERSION_3_2
+	glad_glDrawElementsInstancedBaseVertex = (PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC)load("glDrawElementsInstancedBaseVertex");
+#endif
+#ifndef GL_VERSION_3_3
+	glad_glVertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)load("glVertexAttribDivisor");
+#endif
+#ifndef GL_VERSION_4_3
+	glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+#endif
+
+	return glBindVertexArray && glDeleteVertexArrays && glGenVertexArrays && glBindBufferBase
+		&& glGetUniformBlockIndex && glUniformBlockBinding && glDrawElementsInstancedBaseVertex && glVertexAttribDivisor;
+}
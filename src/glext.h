@@ -0,0 +1,72 @@
+#pragma once
+#include <glad/glad.h>
+
+// The generated loader stops at GL 2.0. What the viewer uses past that is
+// declared here the way glad would, and loaded by LoadGLExtensions.
+
+// Texture arrays, core since 3.0
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY 0x8C1A
+#endif
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+// Core since 4.1 or with ARB_ES2_compatibility, for atlases squeezed into a
+// texture budget. GL_RGB5 stands in without either.
+#ifndef GL_RGB565
+#define GL_RGB565 0x8D62
+#endif
+
+#ifndef GL_VERSION_3_0
+typedef void (APIENTRYP PFNGLBINDVERTEXARRAYPROC)(GLuint array);
+typedef void (APIENTRYP PFNGLDELETEVERTEXARRAYSPROC)(GLsizei n, const GLuint* arrays);
+typedef void (APIENTRYP PFNGLGENVERTEXARRAYSPROC)(GLsizei n, GLuint* arrays);
+typedef void (APIENTRYP PFNGLBINDBUFFERBASEPROC)(GLenum target, GLuint index, GLuint buffer);
+extern PFNGLBINDVERTEXARRAYPROC glad_glBindVertexArray;
+extern PFNGLDELETEVERTEXARRAYSPROC glad_glDeleteVertexArrays;
+extern PFNGLGENVERTEXARRAYSPROC glad_glGenVertexArrays;
+extern PFNGLBINDBUFFERBASEPROC glad_glBindBufferBase;
+#define glBindVertexArray glad_glBindVertexArray
+#define glDeleteVertexArrays glad_glDeleteVertexArrays
+#define glGenVertexArrays glad_glGenVertexArrays
+#define glBindBufferBase glad_glBindBufferBase
+#endif
+
+#ifndef GL_VERSION_3_1
+#define GL_UNIFORM_BUFFER 0x8A11
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+typedef GLuint (APIENTRYP PFNGLGETUNIFORMBLOCKINDEXPROC)(GLuint program, const GLchar* uniformBlockName);
+typedef void (APIENTRYP PFNGLUNIFORMBLOCKBINDINGPROC)(GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding);
+extern PFNGLGETUNIFORMBLOCKINDEXPROC glad_glGetUniformBlockIndex;
+extern PFNGLUNIFORMBLOCKBINDINGPROC glad_glUniformBlockBinding;
+#define glGetUniformBlockIndex glad_glGetUniformBlockIndex
+#define glUniformBlockBinding glad_glUniformBlockBinding
+#endif
+
+#ifndef GL_VERSION_3_2
+typedef void (APIENTRYP PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC)(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount, GLint basevertex);
+extern PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC glad_glDrawElementsInstancedBaseVertex;
+#define glDrawElementsInstancedBaseVertex glad_glDrawElementsInstancedBaseVertex
+#endif
+
+#ifndef GL_VERSION_3_3
+typedef void (APIENTRYP PFNGLVERTEXATTRIBDIVISORPROC)(GLuint index, GLuint divisor);
+extern PFNGLVERTEXATTRIBDIVISORPROC glad_glVertexAttribDivisor;
+#define glVertexAttribDivisor glad_glVertexAttribDivisor
+#endif
+
+// Optional, NULL unless the driver exports it. Check for GL 4.3 or
+// ARB_multi_draw_indirect before use, and for GL 4.2 or ARB_base_instance
+// when a command's baseInstance is not 0.
+#ifndef GL_VERSION_4_3
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+extern PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect;
+#define glMultiDrawElementsIndirect glad_glMultiDrawElementsIndirect
+#endif
+
+// Resolves the entry points above through `load`, after gladLoadGL. False
+// when the context lacks any that is not optional.
+bool LoadGLExtensions(GLADloadproc load);
@@ -1,8 +1,46 @@
 #include "imagepacker.h"
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
 
 constexpr int c_MAXIMAGESIZE = 4096;
 
+// Runs `pack` over the list with every image grown by its padding, then
+// restores the real sizes and moves each position inside its padding.
+// Packing reorders the list, so each entry carries its index in place of the
+// userdata meanwhile.
+template<typename Fn>
+static bool PackPadded(ImagePacker::ImageInformationList& list, int padding, Fn pack)
+{
+	if (padding <= 0)
+		return pack();
+
+	std::vector<ImagePacker::ImageInformation_t> original = list;
+	auto pad = [padding](int size) { return (size + padding * 2 + padding - 1) / padding * padding; };
+	for (size_t i = 0; i < list.size(); ++i)
+	{
+		list[i].width = pad(list[i].width);
+		list[i].height = pad(list[i].height);
+		list[i].userdata = (void*)(uintptr_t)i;
+	}
+
+	const bool packed = pack();
+
+	for (auto& info : list)
+	{
+		const ImagePacker::ImageInformation_t& source = original[(uintptr_t)info.userdata];
+		info.width = source.width;
+		info.height = source.height;
+		info.userdata = source.userdata;
+		info.x += padding;
+		info.y += padding;
+	}
+	return packed;
+}
+
 class AtlasTree
 {
 public:
@@ -145,4 +183,209 @@ int ImagePacker::GeneratePackedList(ImageInformationList& list, int imageStartSi
 int ImagePacker::GeneratePackedList(ImageInformationList& list)
 {
 	return GeneratePackedList(list, 64);
-}
\ No newline at end of file
+}
+
+int ImagePacker::GeneratePackedList(ImageInformationList& list, int imageStartSizeHint, int padding)
+{
+	int size = 0;
+	PackPadded(list, padding, [&]() { size = GeneratePackedList(list, imageStartSizeHint); return size != 0; });
+	return size;
+}
+
+// Lowest-top-edge placement over a skyline of segments covering the sheet width
+class Skyline
+{
+public:
+	Skyline(int width, int maxHeight) : width(width), maxHeight(maxHeight), segments{ { 0, 0, width } } {}
+
+	// Places at the lowest top edge, leftmost on ties. False when there is no
+	// room left for the image.
+	bool Insert(int w, int h, int& outX, int& outY)
+	{
+		int bestTop = maxHeight + 1, bestIndex = -1, bestY = 0;
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			int y;
+			if (Fit(i, w, y) && y + h < bestTop)
+			{
+				bestTop = y + h;
+				bestIndex = (int)i;
+				bestY = y;
+			}
+		}
+		if (bestIndex < 0)
+			return false;
+
+		outX = segments[bestIndex].x;
+		outY = bestY;
+		Place(bestIndex, w, bestY + h);
+		height = std::max(height, bestY + h);
+		return true;
+	}
+
+	int GetHeight() const { return height; }
+
+private:
+	struct segment_t
+	{
+		int x, y, width;
+	};
+
+	// Height a w-wide image starting at segment i rests on
+	bool Fit(size_t i, int w, int& y) const
+	{
+		if (segments[i].x + w > width)
+			return false;
+
+		y = 0;
+		for (int remaining = w; remaining > 0; remaining -= segments[i++].width)
+			y = std::max(y, segments[i].y);
+		return true;
+	}
+
+	void Place(size_t index, int w, int top)
+	{
+		const int x = segments[index].x;
+		size_t end = index;
+		while (end < segments.size() && segments[end].x + segments[end].width <= x + w)
+			++end;
+
+		// The last covered segment may stick out past the image
+		if (end < segments.size() && segments[end].x < x + w)
+		{
+			segments[end].width -= x + w - segments[end].x;
+			segments[end].x = x + w;
+		}
+		segments.erase(segments.begin() + index, segments.begin() + end);
+		segments.insert(segments.begin() + index, { x, top, w });
+
+		// Merge with equal neighbours so the skyline stays short
+		if (index + 1 < segments.size() && segments[index + 1].y == top)
+		{
+			segments[index].width += segments[index + 1].width;
+			segments.erase(segments.begin() + index + 1);
+		}
+		if (index > 0 && segments[index - 1].y == top)
+		{
+			segments[index - 1].width += segments[index].width;
+			segments.erase(segments.begin() + index);
+		}
+	}
+
+	int width;
+	int maxHeight;
+	int height = 0;
+	std::vector<segment_t> segments;
+};
+
+static int NextPowerOfTwo(int v)
+{
+	int p = 1;
+	while (p < v)
+		p <<= 1;
+	return p;
+}
+
+// Spills onto as many c_MAXIMAGESIZE pages as it takes, placing every image
+// on the first page with room for it
+static bool PackSkylinePages(ImagePacker::ImageInformationList& list, int& outHeight, int& outPages)
+{
+	std::vector<Skyline> pages;
+	for (auto& info : list)
+	{
+		if (info.width > c_MAXIMAGESIZE || info.height > c_MAXIMAGESIZE)
+			return false;
+
+		info.page = 0;
+		while (info.page < (int)pages.size() && !pages[info.page].Insert(info.width, info.height, info.x, info.y))
+			++info.page;
+
+		if (info.page == (int)pages.size())
+		{
+			pages.emplace_back(c_MAXIMAGESIZE, c_MAXIMAGESIZE);
+			pages.back().Insert(info.width, info.height, info.x, info.y);
+		}
+	}
+
+	int height = 1;
+	for (auto& page : pages)
+		height = std::max(height, page.GetHeight());
+	outHeight = NextPowerOfTwo(height);
+	outPages = (int)pages.size();
+	return true;
+}
+
+static bool PackSkyline(ImagePacker::ImageInformationList& list, int& outWidth, int& outHeight, int& outPages)
+{
+	// Tallest first, then widest, keeps the skyline flat
+	std::stable_sort(list.begin(), list.end(), [](const auto& a, const auto& b)
+		{
+			return a.height != b.height ? a.height > b.height : a.width > b.width;
+		});
+
+	size_t area = 0;
+	int widest = 1;
+	for (auto& info : list)
+	{
+		area += (size_t)info.width * info.height;
+		widest = std::max(widest, info.width);
+	}
+
+	// Sheets are tried at half, one and two times the width of the smallest
+	// power-of-two square that could hold everything, each with its height
+	// shrunk to what was used. The smallest sheet wins, the squarer on ties.
+	const int squareWidth = NextPowerOfTwo((int)std::min(std::ceil(std::sqrt((double)area)), c_MAXIMAGESIZE * 2.0));
+	std::vector<std::pair<int, int>> positions(list.size()), bestPositions;
+	size_t bestArea = SIZE_MAX;
+	for (int width = std::max(squareWidth / 2, NextPowerOfTwo(widest)); width <= std::min(squareWidth * 2, c_MAXIMAGESIZE); width <<= 1)
+	{
+		Skyline skyline(width, c_MAXIMAGESIZE);
+		bool fits = true;
+		for (size_t i = 0; i < list.size() && fits; ++i)
+			fits = skyline.Insert(list[i].width, list[i].height, positions[i].first, positions[i].second);
+
+		const int height = NextPowerOfTwo(std::max(skyline.GetHeight(), 1));
+		const size_t sheetArea = (size_t)width * height;
+		if (fits && (sheetArea < bestArea || (sheetArea == bestArea && std::abs(width - height) < std::abs(outWidth - outHeight))))
+		{
+			bestArea = sheetArea;
+			outWidth = width;
+			outHeight = height;
+			bestPositions.swap(positions);
+			positions.resize(list.size());
+		}
+	}
+
+	if (bestPositions.empty())
+	{
+		outWidth = c_MAXIMAGESIZE;
+		return PackSkylinePages(list, outHeight, outPages);
+	}
+
+	for (size_t i = 0; i < list.size(); ++i)
+	{
+		list[i].x = bestPositions[i].first;
+		list[i].y = bestPositions[i].second;
+		list[i].page = 0;
+	}
+	outPages = 1;
+	return true;
+}
+
+ImagePacker::PackResult_t ImagePacker::Pack(ImageInformationList& list, int padding)
+{
+	PackResult_t result;
+	if (list.empty())
+		return result;
+
+	int width = 0, height = 0, pages = 0;
+	if (!PackPadded(list, padding, [&]() { return PackSkyline(list, width, height, pages); }))
+		return result;
+
+	result.width = width;
+	result.height = height;
+	result.pages = pages;
+	for (auto& info : list)
+		result.imageTexels += (size_t)info.width * info.height;
+	return result;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <vector>
 
 namespace ImagePacker
@@ -12,13 +13,39 @@ namespace ImagePacker
 
         // Generated by program
         int x = 0, y = 0;
+        // Sheet the image is on, see PackResult_t::pages
+        int page = 0;
 
         ImageInformation_t(int w, int h, void* d) : width(w), height(h), userdata(d) {}
     };
 
     using ImageInformationList = std::vector<ImageInformation_t>;
 
-    // Returns the image size, or 0 if generation failed. Defaults to 64x64
+    struct PackResult_t
+    {
+        // Size of every page
+        int width = 0;
+        int height = 0;
+        int pages = 0;
+        // Texels covered by images, padding counts as waste
+        size_t imageTexels = 0;
+
+        size_t GetSheetTexels() const { return (size_t)width * height * pages; }
+        size_t GetWastedTexels() const { return GetSheetTexels() - imageTexels; }
+        double GetEfficiency() const { return pages > 0 ? imageTexels / (double)GetSheetTexels() : 0.0; }
+    };
+
+    // Skyline bottom-left packer into a power-of-two sheet, not necessarily
+    // square, picked up front from the total area. Keeps `padding` free texels
+    // around every image, with padded sizes rounded up to a multiple of
+    // `padding` so every x and y is a multiple of it too. Images that don't
+    // fit in the largest sheet spill onto further pages of that size, which
+    // only fails, with 0 pages, for an image larger than a page.
+    PackResult_t Pack(ImageInformationList& list, int padding = 0);
+
+    // The original AtlasTree packer, kept to compare against. Single page only,
+    // returns the square image size, or 0 if generation failed. Defaults to 64x64
     int GeneratePackedList(ImageInformationList& list);
     int GeneratePackedList(ImageInformationList& list, int imageStartSizeHint);
+    int GeneratePackedList(ImageInformationList& list, int imageStartSizeHint, int padding);
 }
\ No newline at end of file
@@ -0,0 +1,416 @@
+#include "levelcache.h"
+#include "atlas.h"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+using u32 = uint32_t;
+using u64 = uint64_t;
+
+// Bump whenever any cooked structure or the meshes they hold change layout
+constexpr u32 c_COOKEDVERSION = 8;
+constexpr char c_COOKEDMAGIC[8] = { 'G', '2', 'C', 'O', 'O', 'K', 'E', 'D' };
+constexpr u64 c_SECTIONALIGN = 64;
+
+struct cookedheader_t
+{
+	char magic[8];
+	u32 version;
+	u32 vertexSize;
+	u64 contentHash;
+	u64 fileSize;
+	char levelName[64];
+	u32 modelCount;
+	u32 imageCount;
+	u32 sheetWidth;
+	u32 sheetHeight;
+	u32 sheetLevels;
+	u32 sheetPages;
+	u32 compressedFormat;
+	u32 atlasFormat;
+	u32 degradedCount;
+	u32 chunkCount;
+	u32 reserved;
+	u64 textureBudget;
+	u64 modelOffset;
+	u64 imageOffset;
+	u64 instanceOffset;
+	u64 vertexOffset;
+	u64 indexOffset;
+	u64 indexBytes;
+	u64 sheetOffset;
+	u64 compressedOffset;
+	u64 compressedBytes;
+	u64 degradedOffset;
+	u64 chunkOffset;
+};
+
+struct cookedmodel_t
+{
+	u32 addr;
+	char name[12];
+	u64 firstVertex;
+	u64 vertexCount;
+	// Bytes into the index section, 4-byte aligned
+	u64 firstIndexByte;
+	u64 indexCount;
+	u32 indexSize;
+	u32 firstInstance;
+	u32 instanceCount;
+	u32 firstChunk;
+	u32 chunkCount;
+	u32 reserved;
+};
+
+struct cookedinstance_t
+{
+	float position[3];
+	float rotation[3];
+	u32 isVisible;
+};
+
+struct cookedimage_t
+{
+	int32_t width, height;
+	int32_t x, y;
+	int32_t page;
+	u32 reserved;
+	u64 id;
+};
+
+struct cookeddegraded_t
+{
+	u32 texture;
+	u32 width, height;
+	u32 droppedLevels;
+	u32 storedLevel;
+};
+
+static_assert(sizeof(Vertex) == 16, "cooked vertex layout changed, bump c_COOKEDVERSION");
+static_assert(sizeof(meshchunk_t) == 32, "cooked chunk layout changed, bump c_COOKEDVERSION");
+static_assert(sizeof(rgba8_t) == 4, "cooked sheet layout changed, bump c_COOKEDVERSION");
+
+static u64 LoadU64(const unsigned char* p)
+{
+	u64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// xxHash64-style mixing over four independent lanes, so hashing a pair of
+// mapped files runs close to memory bandwidth.
+static u64 HashBytes(std::span<const unsigned char> bytes, u64 seed)
+{
+	constexpr u64 c_PRIME1 = 0x9E3779B185EBCA87ull;
+	constexpr u64 c_PRIME2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr u64 c_PRIME3 = 0x165667B19E3779F9ull;
+
+	const unsigned char* p = bytes.data();
+	const size_t size = bytes.size();
+	size_t i = 0;
+
+	u64 h = seed + c_PRIME3 + size;
+	if (size >= 32)
+	{
+		u64 lanes[4] = { seed + c_PRIME1 + c_PRIME2, seed + c_PRIME2, seed, seed - c_PRIME1 };
+		for (; i + 32 <= size; i += 32)
+		{
+			for (int l = 0; l < 4; ++l)
+				lanes[l] = std::rotl(lanes[l] + LoadU64(p + i + l * 8) * c_PRIME2, 31) * c_PRIME1;
+		}
+		h = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18) + size;
+	}
+
+	for (; i + 8 <= size; i += 8)
+		h = std::rotl(h ^ (std::rotl(LoadU64(p + i) * c_PRIME2, 31) * c_PRIME1), 27) * c_PRIME1 + c_PRIME3;
+
+	for (; i < size; ++i)
+		h = std::rotl(h ^ (p[i] * c_PRIME3), 11) * c_PRIME1;
+
+	h ^= h >> 33;
+	h *= c_PRIME2;
+	h ^= h >> 29;
+	h *= c_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+u64 HashLevelFiles(const file_t& dfx, const file_t& vfx)
+{
+	u64 h = HashBytes(dfx.data, c_COOKEDVERSION);
+	return HashBytes(vfx.data, h);
+}
+
+std::string GetCookedLevelPath(const std::string& directory, u64 hash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.g2c", (unsigned long long)hash);
+	return (std::filesystem::path(directory) / name).string();
+}
+
+static u64 AlignUp(u64 value)
+{
+	return (value + c_SECTIONALIGN - 1) / c_SECTIONALIGN * c_SECTIONALIGN;
+}
+
+bool LoadCookedLevel(const std::string& cachePath, u64 hash, level_t& level)
+{
+	file_t file;
+	if (!ReadFile(cachePath, file))
+		return false;
+
+	const auto* base = file.data.data();
+	const u64 size = file.size();
+
+	cookedheader_t header;
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, base, sizeof(header));
+
+	if (memcmp(header.magic, c_COOKEDMAGIC, sizeof(header.magic)) != 0
+		|| header.version != c_COOKEDVERSION
+		|| header.vertexSize != sizeof(Vertex)
+		|| header.contentHash != hash
+		|| header.fileSize != size
+		|| header.sheetLevels > c_ATLASMIPLEVELS
+		|| header.compressedFormat > (u32)BlockFormat_t::BC3
+		|| header.atlasFormat > (u32)AtlasFormat_t::RGBA4444)
+		return false;
+
+	auto inBounds = [size](u64 offset, u64 count, u64 stride)
+		{
+			return offset <= size && count <= (size - offset) / stride;
+		};
+
+	const u64 sheetBytes = GetAtlasTexelCount(header.sheetWidth, header.sheetHeight, header.sheetLevels, header.sheetPages) * sizeof(rgba8_t);
+	if (!inBounds(header.modelOffset, header.modelCount, sizeof(cookedmodel_t))
+		|| !inBounds(header.imageOffset, header.imageCount, sizeof(cookedimage_t))
+		|| !inBounds(header.degradedOffset, header.degradedCount, sizeof(cookeddegraded_t))
+		|| !inBounds(header.chunkOffset, header.chunkCount, sizeof(meshchunk_t))
+		|| (sheetBytes != 0 && !inBounds(header.sheetOffset, sheetBytes, 1)))
+		return false;
+
+	const BlockFormat_t compressedFormat = (BlockFormat_t)header.compressedFormat;
+	if (compressedFormat != BlockFormat_t::None
+		&& (header.compressedBytes != GetCompressedAtlasSize(header.sheetWidth, header.sheetHeight, header.sheetLevels, header.sheetPages, compressedFormat)
+			|| !inBounds(header.compressedOffset, header.compressedBytes, 1)))
+		return false;
+
+	const auto* models = (const cookedmodel_t*)(base + header.modelOffset);
+	const auto* instances = (const cookedinstance_t*)(base + header.instanceOffset);
+	const auto* vertices = (const Vertex*)(base + header.vertexOffset);
+	const auto* chunks = (const meshchunk_t*)(base + header.chunkOffset);
+	if (!inBounds(header.indexOffset, header.indexBytes, 1))
+		return false;
+	for (u32 i = 0; i < header.modelCount; ++i)
+	{
+		const cookedmodel_t& m = models[i];
+		if (!inBounds(header.vertexOffset, m.firstVertex + m.vertexCount, sizeof(Vertex))
+			|| (m.indexSize != sizeof(uint16_t) && m.indexSize != sizeof(uint32_t))
+			|| m.firstIndexByte > header.indexBytes
+			|| m.indexCount > (header.indexBytes - m.firstIndexByte) / m.indexSize
+			|| !inBounds(header.instanceOffset, (u64)m.firstInstance + m.instanceCount, sizeof(cookedinstance_t))
+			|| (u64)m.firstChunk + m.chunkCount > header.chunkCount)
+			return false;
+		for (u32 c = 0; c < m.chunkCount; ++c)
+		{
+			const meshchunk_t& chunk = chunks[m.firstChunk + c];
+			if (chunk.firstIndex > m.indexCount || chunk.indexCount > m.indexCount - chunk.firstIndex)
+				return false;
+		}
+	}
+
+	for (u32 i = 0; i < header.modelCount; ++i)
+	{
+		const cookedmodel_t& m = models[i];
+		auto model = std::make_shared<Model>(m.addr);
+		model->name.assign(m.name, strnlen(m.name, sizeof(m.name)));
+		model->mesh.vertices = { vertices + m.firstVertex, (size_t)m.vertexCount };
+		model->mesh.indices = { base + header.indexOffset + m.firstIndexByte, (size_t)(m.indexCount * m.indexSize) };
+		model->mesh.indexSize = m.indexSize;
+		model->mesh.chunks = { chunks + m.firstChunk, (size_t)m.chunkCount };
+		level.meshStats.Add(model->mesh);
+		model->instances.reserve(m.instanceCount);
+		for (u32 j = 0; j < m.instanceCount; ++j)
+		{
+			const cookedinstance_t& inst = instances[m.firstInstance + j];
+			model->instances.push_back({
+				{ inst.position[0], inst.position[1], inst.position[2] },
+				{ inst.rotation[0], inst.rotation[1], inst.rotation[2] },
+				inst.isVisible != 0
+				});
+		}
+		level.models.push_back(model);
+	}
+
+	const auto* images = (const cookedimage_t*)(base + header.imageOffset);
+	for (u32 i = 0; i < header.imageCount; ++i)
+	{
+		ImagePacker::ImageInformation_t info(images[i].width, images[i].height, (void*)(uintptr_t)images[i].id);
+		info.x = images[i].x;
+		info.y = images[i].y;
+		info.page = images[i].page;
+		level.list.push_back(info);
+	}
+
+	// Read-only view, nothing writes to the sheet after loading
+	if (sheetBytes != 0)
+	{
+		level.sheet = { header.sheetWidth, header.sheetHeight, (rgba8_t*)(base + header.sheetOffset) };
+		level.sheetLevels = header.sheetLevels;
+		level.sheetPages = header.sheetPages;
+	}
+	if (compressedFormat != BlockFormat_t::None)
+	{
+		level.compressedFormat = compressedFormat;
+		level.compressedSheet = { base + header.compressedOffset, (size_t)header.compressedBytes };
+	}
+
+	level.atlasFormat = (AtlasFormat_t)header.atlasFormat;
+	level.textureBudget = (size_t)header.textureBudget;
+	const auto* degraded = (const cookeddegraded_t*)(base + header.degradedOffset);
+	for (u32 i = 0; i < header.degradedCount; ++i)
+		level.degradedTextures.push_back({ degraded[i].texture, degraded[i].width, degraded[i].height, degraded[i].droppedLevels, degraded[i].storedLevel != 0 });
+
+	level.name.assign(header.levelName, strnlen(header.levelName, sizeof(header.levelName)));
+	level.fromCache = true;
+	level.cookedData = file.backing;
+	return true;
+}
+
+bool WriteCookedLevel(const std::string& cachePath, u64 hash, const level_t& level)
+{
+	std::vector<cookedmodel_t> models;
+	std::vector<cookedinstance_t> instances;
+	std::vector<meshchunk_t> chunks;
+	u64 vertexCount = 0;
+	u64 indexBytes = 0;
+	for (auto& model : level.models)
+	{
+		cookedmodel_t m{};
+		m.addr = model->addr;
+		strncpy(m.name, model->name.c_str(), sizeof(m.name) - 1);
+		m.firstVertex = vertexCount;
+		m.vertexCount = model->mesh.vertices.size();
+		m.firstIndexByte = indexBytes;
+		m.indexCount = model->mesh.GetIndexCount();
+		m.indexSize = model->mesh.indexSize;
+		m.firstInstance = (u32)instances.size();
+		m.instanceCount = (u32)model->instances.size();
+		m.firstChunk = (u32)chunks.size();
+		m.chunkCount = (u32)model->mesh.chunks.size();
+		chunks.insert(chunks.end(), model->mesh.chunks.begin(), model->mesh.chunks.end());
+		for (auto& inst : model->instances)
+		{
+			instances.push_back({
+				{ inst.position.x, inst.position.y, inst.position.z },
+				{ inst.rotation.x, inst.rotation.y, inst.rotation.z },
+				inst.isVisible ? 1u : 0u
+				});
+		}
+		vertexCount += m.vertexCount;
+		indexBytes = (indexBytes + model->mesh.indices.size() + 3) & ~3ull;
+		models.push_back(m);
+	}
+
+	std::vector<cookedimage_t> images;
+	for (auto& info : level.list)
+		images.push_back({ info.width, info.height, info.x, info.y, info.page, 0, (u64)(uintptr_t)info.userdata });
+
+	std::vector<cookeddegraded_t> degraded;
+	for (auto& d : level.degradedTextures)
+		degraded.push_back({ d.texture, d.width, d.height, d.droppedLevels, d.storedLevel ? 1u : 0u });
+
+	cookedheader_t header{};
+	memcpy(header.magic, c_COOKEDMAGIC, sizeof(header.magic));
+	header.version = c_COOKEDVERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.contentHash = hash;
+	strncpy(header.levelName, level.name.c_str(), sizeof(header.levelName) - 1);
+	header.modelCount = (u32)models.size();
+	header.imageCount = (u32)images.size();
+	header.degradedCount = (u32)degraded.size();
+	header.chunkCount = (u32)chunks.size();
+	header.atlasFormat = (u32)level.atlasFormat;
+	header.textureBudget = level.textureBudget;
+	header.sheetWidth = level.sheet.pixels ? level.sheet.w : 0;
+	header.sheetHeight = level.sheet.pixels ? level.sheet.h : 0;
+	header.sheetLevels = level.sheet.pixels ? level.sheetLevels : 0;
+	header.sheetPages = level.sheet.pixels ? level.sheetPages : 0;
+	header.modelOffset = AlignUp(sizeof(header));
+	header.imageOffset = AlignUp(header.modelOffset + models.size() * sizeof(cookedmodel_t));
+	header.degradedOffset = AlignUp(header.imageOffset + images.size() * sizeof(cookedimage_t));
+	header.chunkOffset = AlignUp(header.degradedOffset + degraded.size() * sizeof(cookeddegraded_t));
+	header.instanceOffset = AlignUp(header.chunkOffset + chunks.size() * sizeof(meshchunk_t));
+	header.vertexOffset = AlignUp(header.instanceOffset + instances.size() * sizeof(cookedinstance_t));
+	header.indexOffset = AlignUp(header.vertexOffset + vertexCount * sizeof(Vertex));
+	header.indexBytes = indexBytes;
+	header.sheetOffset = AlignUp(header.indexOffset + header.indexBytes);
+	const u64 sheetBytes = GetAtlasTexelCount(header.sheetWidth, header.sheetHeight, header.sheetLevels, header.sheetPages) * sizeof(rgba8_t);
+	if (level.sheet.pixels && !level.compressedSheet.empty())
+	{
+		header.compressedFormat = (u32)level.compressedFormat;
+		header.compressedBytes = level.compressedSheet.size();
+	}
+	header.compressedOffset = AlignUp(header.sheetOffset + sheetBytes);
+	header.fileSize = header.compressedOffset + header.compressedBytes;
+
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), ec);
+
+	// Write next to the target and rename, so concurrent cooks of the same
+	// level never expose a partial file
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+	const std::string tmpPath = cachePath + suffix;
+	FILE* f = fopen(tmpPath.c_str(), "wb");
+	if (!f)
+		return false;
+
+	u64 written = 0;
+	bool ok = true;
+	auto write = [&](u64 offset, const void* data, u64 bytes)
+		{
+			static const unsigned char zeros[c_SECTIONALIGN] = {};
+			while (ok && written < offset)
+			{
+				u64 pad = std::min<u64>(offset - written, sizeof(zeros));
+				ok = fwrite(zeros, 1, pad, f) == pad;
+				written += pad;
+			}
+			if (ok && bytes != 0)
+			{
+				ok = fwrite(data, 1, bytes, f) == bytes;
+				written += bytes;
+			}
+		};
+
+	write(0, &header, sizeof(header));
+	write(header.modelOffset, models.data(), models.size() * sizeof(cookedmodel_t));
+	write(header.imageOffset, images.data(), images.size() * sizeof(cookedimage_t));
+	write(header.degradedOffset, degraded.data(), degraded.size() * sizeof(cookeddegraded_t));
+	write(header.chunkOffset, chunks.data(), chunks.size() * sizeof(meshchunk_t));
+	write(header.instanceOffset, instances.data(), instances.size() * sizeof(cookedinstance_t));
+	write(header.vertexOffset, nullptr, 0);
+	for (auto& model : level.models)
+		write(written, model->mesh.vertices.data(), model->mesh.vertices.size() * sizeof(Vertex));
+	for (size_t i = 0; i < level.models.size(); ++i)
+		write(header.indexOffset + models[i].firstIndexByte, level.models[i]->mesh.indices.data(), level.models[i]->mesh.indices.size());
+
+	write(header.sheetOffset, nullptr, 0);
+	write(written, level.sheet.pixels, sheetBytes);
+	write(header.compressedOffset, level.compressedSheet.data(), header.compressedBytes);
+
+	ok = fclose(f) == 0 && ok;
+	if (ok)
+	{
+		std::filesystem::rename(tmpPath, cachePath, ec);
+		ok = !ec;
+	}
+	if (!ok)
+		std::filesystem::remove(tmpPath, ec);
+	return ok;
+}
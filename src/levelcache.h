@@ -0,0 +1,18 @@
+#pragma once
+#include "filereader.h"
+#include "mapreader.h"
+#include <cstdint>
+#include <string>
+
+// Cooked levels hold everything the viewer needs after LoadLevel: meshes,
+// instances, the packed texture list and the RGBA8 atlas with its mips, plus its
+// block compressed copy when there is one and the textures shrunk to fit the
+// texture budget. Sections are aligned and stored in native layout so a mapped
+// cache is used in place.
+
+// Content hash of a .dfx/.vfx pair, `vfx` may be empty
+uint64_t HashLevelFiles(const file_t& dfx, const file_t& vfx);
+std::string GetCookedLevelPath(const std::string& directory, uint64_t hash);
+
+bool LoadCookedLevel(const std::string& cachePath, uint64_t hash, level_t& level);
+bool WriteCookedLevel(const std::string& cachePath, uint64_t hash, const level_t& level);
@@ -1,11 +1,14 @@
 #include "shader.h"
 #include "mapreader.h"
+#include "atlas.h"
+#include "scenearena.h"
 
 #ifdef _WIN32
+#define NOMINMAX
 #include <Windows.h>
 #endif
 
-#include <glad/glad.h>
+#include "glext.h"
 #include <GLFW/glfw3.h>
 
 #include <imgui/imgui.h>
@@ -20,7 +23,11 @@
 #include <glm/ext/scalar_constants.hpp> // glm::pi
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <vector>
 
 #include <fstream>
@@ -49,13 +56,6 @@ std::string OpenLoadPrompt(const char* filter) {}
 glm::vec3 g_CamPos = { 0, 0, 0 };
 glm::vec2 g_CamRot = { 0, 0 };
 
-struct Vertex
-{
-    glm::vec3 position;
-    glm::vec4 color;
-    glm::vec2 uv;
-};
-
 glm::vec3 GetUpVector()
 {
     return { 0, 1, 0 };
@@ -84,8 +84,21 @@ static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 struct sleveldata_t
 {
     level_t level;
+    // GL_TEXTURE_2D_ARRAY with one layer per atlas page
     GLuint texid = 0;
+    // Level 0 of one page as a plain 2D texture for the texture panel, which
+    // can't show array layers. Optionally through ExpandTexture, to compare
+    // against the RGBA8 path.
+    GLuint previewTexid = 0;
+    int previewPage = -1;
+    bool previewFloat = false;
+    // One of level.textures for the texture panel, when they were kept
+    GLuint sourceTexid = 0;
+    int sourceIndex = -1;
     bool open = false;
+    // Set when instance or object visibility changes, the scene's draw
+    // candidates are gathered again before the next draw
+    bool instancesDirty = true;
 };
 
 static void mouse_callback(GLFWwindow* window, double x, double y)
@@ -154,22 +167,14 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 
 GLFWwindow* g_Window = nullptr;
 
-bool cameraInvalidated = true;
-
-glm::mat4 camera(const glm::mat4& model)
+// Projection * View, once a frame
+glm::mat4 GetViewProjection()
 {
-    static glm::mat4 Projection;
-    static glm::mat4 View;
-    if (cameraInvalidated)
-    {
-        int w, h;
-        glfwGetWindowSize(g_Window, &w, &h);
-        Projection = glm::perspective(glm::pi<float>() * 0.25f, w / (float)h, 0.1f, 100.f);
-        View = glm::lookAt(g_CamPos, g_CamPos + GetForwardVector() * 10.f, GetUpVector());
-        cameraInvalidated = false;
-    }
-    
-    return Projection * View * model;
+    int w, h;
+    glfwGetWindowSize(g_Window, &w, &h);
+    glm::mat4 Projection = glm::perspective(glm::pi<float>() * 0.25f, w / (float)std::max(h, 1), 0.1f, 100.f);
+    glm::mat4 View = glm::lookAt(g_CamPos, g_CamPos + GetForwardVector() * 10.f, GetUpVector());
+    return Projection * View;
 }
 
 bool IsBillboardObject(const std::string& name)
@@ -245,95 +250,629 @@ bool IsBillboardObject(const std::string& name)
         }) != pENDPTR;
 }
 
-struct globj_t
+// Uniform block shared by both stages of the level shader, std140
+struct frameuniforms_t
+{
+    glm::mat4 viewProjection;
+    GLint renderMode; // Wireframe, vertex colours, textures and billboarding bits
+    GLfloat billboardYaw; // Radians, turns billboards to face the camera
+    GLint pad[2];
+};
+constexpr GLuint c_FRAMEUNIFORMBINDING = 0;
+constexpr GLint c_RENDERMODEBILLBOARDS = 1 << 3;
+
+// The level shader with its uniform locations, looked up once after linking
+struct levelprogram_t
+{
+    GLuint program = 0;
+    GLuint frameUbo = 0;
+};
+
+bool InitLevelProgram(levelprogram_t& lp, GLuint program)
+{
+    lp.program = program;
+    const GLuint frameBlock = glGetUniformBlockIndex(program, "Frame");
+    if (frameBlock == GL_INVALID_INDEX)
+        return false;
+    glUniformBlockBinding(program, frameBlock, c_FRAMEUNIFORMBINDING);
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "uTexture"), 0);
+    glUseProgram(0);
+
+    glGenBuffers(1, &lp.frameUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, lp.frameUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(frameuniforms_t), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return true;
+}
+
+// GL calls the level draw made in a frame. Before vertex array objects, the
+// frame uniform block and instancing, every instance was a draw that
+// re-specified its buffers and attributes and looked up and set every uniform.
+struct renderstats_t
 {
+    // What that draw made per instance: 2 buffer binds, 3 attribute pointers
+    // and enables, 4 uniform lookups and sets, the texture unit and bind, the
+    // program and the draw. Only an estimate of the old path's total, which
+    // is no longer built to count.
+    static constexpr size_t c_UNBATCHEDCALLSPERINSTANCE = 2 + 3 * 2 + 4 * 2 + 2 + 1 + 1;
+
+    // Model chunks drawn, and the GL draw calls that took
+    size_t draws = 0;
+    size_t submissions = 0;
+    size_t instances = 0;
+    size_t glCalls = 0;
+    // CPU time from binding the shader to the last draw call, culling included
+    double submitMs = 0;
+    // Times the draw candidates were gathered, which only happens after a
+    // visibility change
+    size_t compactions = 0;
+    // What the frustum test kept and the CPU time it and packing the
+    // survivors took
+    scenedrawcounts_t culling;
+    double cullMs = 0;
+
+    size_t GetUnbatchedCalls() const { return instances * c_UNBATCHEDCALLSPERINSTANCE; }
+};
+
+// ARB_multi_draw_indirect with base instances, without it each model is its
+// own draw call
+bool g_HasMultiDrawIndirect = false;
+bool g_UseMultiDraw = true;
+bool g_FrustumCulling = true;
+
+// Every mesh of the level in one vertex and index arena, drawn from a single
+// VAO. The chunks and instances inside the frustum are packed into one
+// instance buffer, and one indirect command per model chunk selects its range
+// of both; that is only redone when the set inside the frustum changes.
+struct glscene_t
+{
+    GLuint vao = 0;
     GLuint vbo = 0;
-    std::vector<Vertex> vertices;
-    void draw(GLuint program, sleveldata_t& leveldata, objinstance_t& inst, const std::string& name)
+    GLuint ibo = 0;
+    GLuint instanceBuffer = 0;
+    GLuint indirectBuffer = 0;
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    scenearena_t arena;
+    std::vector<bool> billboards; // Per model
+    size_t instanceCapacity = 0;
+    size_t commandCapacity = 0;
+    // Instance the attributes currently start at, the fallback path moves
+    // them for every draw
+    size_t attributeBaseInstance = 0;
+    scenecandidates_t candidates;
+    std::vector<unsigned char> visible; // Per candidate
+    // The mask the uploaded draws were built from, and what they kept
+    std::vector<unsigned char> uploadedVisible;
+    bool uploaded = false;
+    scenedrawcounts_t counts;
+    std::vector<sceneinstance_t> instances;
+    std::vector<drawcommand_t> commands;
+
+    // Lays out the arena and creates its buffers, recording the vertex and
+    // instance layout in the VAO once
+    void create(const std::vector<std::shared_ptr<Model>>& models)
     {
+        arena = LayoutSceneArena(models);
+        indexType = arena.indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        billboards.resize(models.size());
+        size_t maxInstances = 0;
+        for (size_t i = 0; i < models.size(); ++i)
+        {
+            billboards[i] = IsBillboardObject(models[i]->name);
+            maxInstances += models[i]->instances.size() * models[i]->mesh.chunks.size();
+        }
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ibo);
+        glGenBuffers(1, &instanceBuffer);
+        glGenBuffers(1, &indirectBuffer);
+        glBindVertexArray(vao);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        glBufferData(GL_ARRAY_BUFFER, std::max<size_t>(arena.GetVertexBytes(), 1), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, std::max<size_t>(arena.GetIndexBytes(), 1), NULL, GL_STATIC_DRAW);
+        // Position with the page as w, scaled in the shader
+        glVertexAttribPointer(0, 4, GL_SHORT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
         glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)sizeof(glm::vec3));
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, color));
         glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(glm::vec3) + sizeof(glm::vec4)));
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
         glEnableVertexAttribArray(2);
 
-        glm::mat4 Model = glm::translate(glm::mat4(1.f), -inst.position);
-        bool doBillboarding = enableBillboarding && IsBillboardObject(name);
-        if (doBillboarding)
+        instanceCapacity = std::max<size_t>(maxInstances, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(sceneinstance_t), NULL, GL_DYNAMIC_DRAW);
+        pointInstances(0);
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, 1);
+        // Unbind first, so uploads to the element buffer don't touch this VAO
+        glBindVertexArray(0);
+    }
+
+    void release()
+    {
+        glDeleteVertexArrays(1, &vao);
+        const GLuint buffers[] = { vbo, ibo, instanceBuffer, indirectBuffer };
+        glDeleteBuffers(4, buffers);
+        vao = vbo = ibo = instanceBuffer = indirectBuffer = 0;
+    }
+
+    // Instance attributes from `baseInstance` on, with the VAO and the
+    // instance buffer bound
+    void pointInstances(size_t baseInstance)
+    {
+        const size_t offset = baseInstance * sizeof(sceneinstance_t);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(sceneinstance_t), (void*)(offset + offsetof(sceneinstance_t, position)));
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(sceneinstance_t), (void*)(offset + offsetof(sceneinstance_t, billboard)));
+        attributeBaseInstance = baseInstance;
+    }
+
+    // Gathers the chunks of the visible instances and their bounds, after a
+    // visibility change. With culling off everything is drawn, so the
+    // instances and commands are uploaded here once.
+    void compact(const std::vector<std::shared_ptr<Model>>& models, size_t modelCount, bool frustumCulling)
+    {
+        BuildSceneCandidates(models, modelCount, billboards, candidates);
+        visible.resize(candidates.drawables.size());
+        uploaded = false;
+        if (!frustumCulling && vao != 0)
+        {
+            std::fill(visible.begin(), visible.end(), 1);
+            upload(models);
+        }
+    }
+
+    // Keeps the candidates inside the frustum, or all of them with culling
+    // off. The draws are only rebuilt and uploaded when that changed.
+    void cull(const std::vector<std::shared_ptr<Model>>& models, const glm::mat4& viewProjection, bool frustumCulling, renderstats_t& stats)
+    {
+        if (vao == 0)
+            return;
+        const double start = glfwGetTime();
+        if (frustumCulling)
+            CullBoxes(ExtractFrustum(glm::value_ptr(viewProjection)), candidates.bounds, visible.data());
+        else
+            std::fill(visible.begin(), visible.end(), 1);
+        if (!uploaded || visible != uploadedVisible)
+            stats.glCalls += upload(models);
+        stats.culling = counts;
+        stats.cullMs = (glfwGetTime() - start) * 1000.0;
+    }
+
+    // Packs the visible candidates into instances and draw commands and
+    // uploads both, returning the GL calls that took. The buffers are
+    // orphaned first so the previous frame's draws don't stall the upload.
+    size_t upload(const std::vector<std::shared_ptr<Model>>& models)
+    {
+        size_t glCalls = 0;
+        counts = BuildSceneDraws(models, arena, candidates, visible.data(), instances, commands);
+        uploadedVisible = visible;
+        uploaded = true;
+
+        if (!instances.empty())
+        {
+            instanceCapacity = std::max(instanceCapacity, instances.size());
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(sceneinstance_t), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(sceneinstance_t), instances.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glCalls += 4;
+        }
+        if (g_HasMultiDrawIndirect && !commands.empty())
+        {
+            commandCapacity = std::max(commandCapacity, commands.size());
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commandCapacity * sizeof(drawcommand_t), NULL, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(drawcommand_t), commands.data());
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            glCalls += 4;
+        }
+        return glCalls;
+    }
+
+    void draw(bool multiDraw, renderstats_t& stats)
+    {
+        if (vao == 0 || commands.empty())
+            return;
+        glBindVertexArray(vao);
+        ++stats.glCalls;
+        if (multiDraw)
         {
-            Model = glm::rotate(Model, glm::radians(g_CamRot.x-180), {0, 1, 0});
+            if (attributeBaseInstance != 0)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+                pointInstances(0);
+                stats.glCalls += 3;
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, NULL, (GLsizei)commands.size(), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            stats.glCalls += 3;
         }
         else
         {
-            //Model = glm::rotate(Model, -inst.rotation.x, { 1, 0, 0 });
-            Model = glm::rotate(Model, -inst.rotation.y, { 0, 1, 0 });
-            //Model = glm::rotate(Model, -inst.rotation.z, { 0, 0, 1 });
+            // Without base instances the instance attributes are moved to
+            // each model's range instead
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            ++stats.glCalls;
+            for (auto& command : commands)
+            {
+                if (command.baseInstance != attributeBaseInstance)
+                {
+                    pointInstances(command.baseInstance);
+                    stats.glCalls += 2;
+                }
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, indexType, (void*)((size_t)command.firstIndex * arena.indexSize),
+                    command.instanceCount, command.baseVertex);
+                ++stats.glCalls;
+            }
         }
-        glm::mat4 cam = camera(Model);
-        glUniformMatrix4fv(glGetUniformLocation(program, "uCamera"), 1, false, glm::value_ptr(cam));
-        glUniform1i(glGetUniformLocation(program, "uWireframe"), (wireframe << 0) | (vertexCols << 1) | (texturesVis << 2));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, leveldata.texid);
-        glUniform1i(glGetUniformLocation(program, "uTexture"), 0);
-        // extra hack for billboarding transparency
-        // todo: hopefully remove with fixed textures
-        glUniform1i(glGetUniformLocation(program, "uBillboard"), (int)doBillboarding);
-        glUseProgram(program);
-
-        glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+        stats.draws += commands.size();
+        stats.submissions += multiDraw ? 1 : commands.size();
+        stats.instances += instances.size();
     }
 };
-std::vector<std::shared_ptr<globj_t>> mdls;
+
+// Binds the shader, atlas and this frame's uniforms ahead of the level's draws
+void BeginLevelDraw(const levelprogram_t& program, const sleveldata_t& leveldata, const glm::mat4& viewProjection, renderstats_t& stats)
+{
+    stats.draws = stats.submissions = stats.instances = stats.glCalls = 0;
+    frameuniforms_t frame = {};
+    frame.viewProjection = viewProjection;
+    frame.renderMode = (wireframe << 0) | (vertexCols << 1) | (texturesVis << 2) | (enableBillboarding ? c_RENDERMODEBILLBOARDS : 0);
+    frame.billboardYaw = glm::radians(g_CamRot.x - 180);
+
+    glUseProgram(program.program);
+    glBindBuffer(GL_UNIFORM_BUFFER, program.frameUbo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+    glBindBufferBase(GL_UNIFORM_BUFFER, c_FRAMEUNIFORMBINDING, program.frameUbo);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, leveldata.texid);
+    stats.glCalls += 6;
+}
+
+void EndLevelDraw(renderstats_t& stats)
+{
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    stats.glCalls += 2;
+}
+
+glscene_t g_Scene;
 
 void CloseLevel(sleveldata_t& leveldata)
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
     if (leveldata.texid != 0)
         glDeleteTextures(1, &leveldata.texid);
     leveldata.texid = 0;
-    for (auto& tex : leveldata.level.textures)
-        delete[] tex.pixels;
-    leveldata.level.textures.clear();
-    leveldata.level.models.clear();
+    if (leveldata.previewTexid != 0)
+        glDeleteTextures(1, &leveldata.previewTexid);
+    leveldata.previewTexid = 0;
+    leveldata.previewPage = -1;
+    if (leveldata.sourceTexid != 0)
+        glDeleteTextures(1, &leveldata.sourceTexid);
+    leveldata.sourceTexid = 0;
+    leveldata.sourceIndex = -1;
+    UnloadLevel(leveldata.level);
     leveldata.open = false;
-    mdls.clear();
+    g_Scene.release();
+    g_Scene = {};
+}
+
+// A level being opened in the background. The worker thread parses and decodes
+// into `level`, then the render thread uploads it in bounded chunks per frame
+// and swaps it in, so the current level keeps rendering until then.
+struct pendinglevel_t
+{
+    std::string path;
+    level_t level;
+    loadprogress_t progress;
+    std::thread worker;
+    std::atomic<bool> workerDone{ false };
+    bool loaded = false;
+
+    glscene_t scene;
+    std::vector<unsigned char> indexScratch;
+    GLuint texid = 0;
+    size_t uploadModel = 0;
+    size_t uploadOffset = 0;
+    unsigned int uploadMip = 0;
+    unsigned int uploadRow = 0;
+    size_t uploadedBytes = 0;
+    size_t totalBytes = 0;
+};
+
+// Upper bound on buffer and texture data sent to GL per frame
+constexpr size_t c_UPLOADBYTESPERFRAME = 8 * 1024 * 1024;
+
+std::unique_ptr<pendinglevel_t> g_PendingLevel;
+// Cancelled loads whose worker has not returned yet
+std::vector<std::unique_ptr<pendinglevel_t>> g_CancelledLevels;
+// Set from the texture panel, applies to the next level opened
+bool g_KeepTextures = false;
+bool g_CompressTextures = true;
+// EXT_texture_compression_s3tc, without it the atlas is uploaded as RGBA8
+bool g_HasS3TC = false;
+// GL 4.1 or ARB_ES2_compatibility, for GL_RGB565
+bool g_HasRGB565 = false;
+// GPU megabytes the next level's atlas may take, 0 for no limit
+int g_TextureBudgetMB = 0;
+
+// The compressed sheet when the driver takes it, RGBA8 otherwise
+BlockFormat_t GetUploadFormat(const level_t& level)
+{
+    return g_HasS3TC && !level.compressedSheet.empty() ? level.compressedFormat : BlockFormat_t::None;
+}
+
+// GL internal format of the uploaded atlas, the driver converts RGBA8 texels
+// down to a 16-bit atlas format
+GLenum GetInternalFormat(const level_t& level)
+{
+    switch (GetUploadFormat(level))
+    {
+    case BlockFormat_t::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat_t::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default: break;
+    }
+    switch (level.atlasFormat)
+    {
+    case AtlasFormat_t::RGB565: return g_HasRGB565 ? GL_RGB565 : GL_RGB5;
+    case AtlasFormat_t::RGBA4444: return GL_RGBA4;
+    default: return GL_RGBA8;
+    }
 }
 
-std::shared_ptr<globj_t> createobj(std::shared_ptr<Model> model)
+void ReleasePendingObjects(pendinglevel_t& pending)
 {
-    auto ptr = std::make_shared<globj_t>();
+    pending.scene.release();
+    if (pending.texid != 0)
+        glDeleteTextures(1, &pending.texid);
+    pending.texid = 0;
+}
 
-    for (auto& p : model->polygons)
+void CancelPendingLevel()
+{
+    if (!g_PendingLevel)
+        return;
+
+    g_PendingLevel->progress.cancelled = true;
+    ReleasePendingObjects(*g_PendingLevel);
+    g_CancelledLevels.push_back(std::move(g_PendingLevel));
+}
+
+void ReapCancelledLevels(bool wait)
+{
+    for (auto it = g_CancelledLevels.begin(); it != g_CancelledLevels.end();)
     {
-        for (int i = 0; i < 3; ++i)
+        if (wait || (*it)->workerDone)
         {
-            auto& v = model->vertices[p.vertex[i]];
-            ptr->vertices.push_back({ {v.x / 1000.f, v.y / 1000.f, v.z / 1000.f}, {v.r / 255.f, v.g / 255.f, v.b / 255.f, v.a / 255.f}, p.uvs[i] });
-            if (p.materialID == 0xFFFF'FFFF)
-                ptr->vertices.rbegin()->color.a = 0.f;
+            (*it)->worker.join();
+            UnloadLevel((*it)->level);
+            it = g_CancelledLevels.erase(it);
         }
+        else
+            ++it;
     }
+}
 
-    glGenBuffers(1, &ptr->vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, ptr->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * ptr->vertices.size(), ptr->vertices.data(), GL_STATIC_DRAW);
+void BeginOpenLevel(const std::string& path)
+{
+    CancelPendingLevel();
+    printf("Loading level \"%s\"\n", path.c_str());
 
-    return ptr;
+    g_PendingLevel = std::make_unique<pendinglevel_t>();
+    g_PendingLevel->path = path;
+    g_PendingLevel->worker = std::thread([pending = g_PendingLevel.get(), keepTextures = g_KeepTextures, compress = g_CompressTextures && g_HasS3TC, budget = (size_t)g_TextureBudgetMB * 1024 * 1024]
+        {
+            loadoptions_t options;
+            options.cacheDirectory = "../cache";
+            options.progress = &pending->progress;
+            options.keepTextures = keepTextures;
+            options.compressAtlas = compress;
+            options.textureBudget = budget;
+            pending->loaded = LoadLevel(pending->path, pending->level, options);
+            pending->workerDone = true;
+        });
 }
 
-std::string levelPath, levelName;
-bool OpenLevel(const char* levelPath, sleveldata_t& leveldata)
+// Sends up to `budget` bytes of the pending level to GL, returns true once
+// every buffer and the atlas are uploaded
+bool UploadPendingLevel(pendinglevel_t& pending, size_t budget)
 {
-    CloseLevel(leveldata);
-    printf("Loading level \"%s\"\n", levelPath);
-    if (!LoadLevel(levelPath, leveldata.level))
+    auto& models = pending.level.models;
+    auto& sheet = pending.level.sheet;
+    const unsigned int levels = pending.level.sheetLevels;
+    const unsigned int pages = pending.level.sheetPages;
+    const BlockFormat_t format = GetUploadFormat(pending.level);
+
+    if (pending.scene.vao == 0)
     {
-        ::levelPath = levelName = "";
-        return false;
+        pending.scene.create(models);
+        pending.totalBytes = pending.scene.arena.GetVertexBytes() + pending.scene.arena.GetIndexBytes();
+        if (format != BlockFormat_t::None)
+            pending.totalBytes += pending.level.compressedSheet.size();
+        else
+            pending.totalBytes += GetAtlasTexelCount(sheet.w, sheet.h, levels, pages) * sizeof(rgba8_t);
     }
-    ::levelPath = levelPath;
+
+    // Each model's vertices, then its indices, into its range of the arena
+    const scenearena_t& arena = pending.scene.arena;
+    while (pending.uploadModel < models.size())
+    {
+        const mesh_t& mesh = models[pending.uploadModel]->mesh;
+        const arenarange_t& range = arena.ranges[pending.uploadModel];
+        const size_t vertexBytes = mesh.vertices.size_bytes();
+        const size_t modelBytes = vertexBytes + (size_t)range.indexCount * arena.indexSize;
+
+        const size_t end = pending.uploadOffset < vertexBytes ? vertexBytes : modelBytes;
+        size_t chunk = std::min(budget, end - pending.uploadOffset);
+        if (chunk != 0 && pending.uploadOffset < vertexBytes)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, pending.scene.vbo);
+            glBufferSubData(GL_ARRAY_BUFFER, (size_t)range.baseVertex * sizeof(Vertex) + pending.uploadOffset, chunk, (const char*)mesh.vertices.data() + pending.uploadOffset);
+        }
+        else if (chunk != 0)
+        {
+            // Whole indices, widened when the arena is 32-bit and this mesh isn't
+            const size_t first = (pending.uploadOffset - vertexBytes) / arena.indexSize;
+            const size_t count = std::max<size_t>(chunk / arena.indexSize, 1);
+            chunk = count * arena.indexSize;
+            const unsigned char* src = mesh.indices.data() + first * mesh.indexSize;
+            if (mesh.indexSize != arena.indexSize)
+            {
+                pending.indexScratch.resize(chunk);
+                CopyArenaIndices(mesh, first, count, arena.indexSize, pending.indexScratch.data());
+                src = pending.indexScratch.data();
+            }
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pending.scene.ibo);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, ((size_t)range.firstIndex + first) * arena.indexSize, chunk, src);
+        }
+        pending.uploadOffset += chunk;
+        pending.uploadedBytes += chunk;
+        budget -= std::min(budget, chunk);
+
+        if (pending.uploadOffset < modelBytes)
+        {
+            if (budget == 0)
+                return false;
+            continue;
+        }
+        pending.uploadOffset = 0;
+        ++pending.uploadModel;
+    }
+
+    const GLenum internalFormat = GetInternalFormat(pending.level);
+    glActiveTexture(GL_TEXTURE0);
+    if (pending.texid == 0)
+    {
+        glGenTextures(1, &pending.texid);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pending.texid);
+        for (unsigned int mip = 0; mip < levels; ++mip)
+        {
+            const unsigned int w = GetMipSize(sheet.w, mip), h = GetMipSize(sheet.h, mip);
+            if (format != BlockFormat_t::None)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, mip, internalFormat, w, h, pages, 0, (GLsizei)(GetCompressedSize(w, h, format) * pages), NULL);
+            else
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, mip, internalFormat, w, h, pages, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels > 0 ? levels - 1 : 0);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, pending.texid);
+    while (pending.uploadMip < levels)
+    {
+        // Rows of all pages stacked, a chunk never crosses into the next page.
+        // Compressed levels go by rows of 4x4 blocks. At least one row per
+        // frame so the upload always advances.
+        const unsigned int w = GetMipSize(sheet.w, pending.uploadMip), h = GetMipSize(sheet.h, pending.uploadMip);
+        const unsigned int rowTexels = format != BlockFormat_t::None ? 4 : 1;
+        const unsigned int pageRows = (h + rowTexels - 1) / rowTexels;
+        const unsigned int page = pending.uploadRow / pageRows;
+        const unsigned int pageRow = pending.uploadRow % pageRows;
+        const size_t rowBytes = format != BlockFormat_t::None ? GetCompressedSize(w, rowTexels, format) : sizeof(rgba8_t) * w;
+        const unsigned int rows = std::min<unsigned int>(pageRows - pageRow, (unsigned int)std::max<size_t>(budget / rowBytes, 1));
+        if (format != BlockFormat_t::None)
+        {
+            const unsigned char* src = pending.level.compressedSheet.data() + GetCompressedAtlasOffset(sheet.w, sheet.h, pending.uploadMip, page, pages, format) + pageRow * rowBytes;
+            const unsigned int y = pageRow * rowTexels;
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, pending.uploadMip, 0, y, page, w, std::min(rows * rowTexels, h - y), 1, internalFormat, (GLsizei)(rowBytes * rows), src);
+        }
+        else
+        {
+            const texture_t atlasLevel = GetAtlasLevel(sheet, pending.uploadMip, pages);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, pending.uploadMip, 0, pageRow, page, w, rows, 1, GL_RGBA, GL_UNSIGNED_BYTE, atlasLevel.pixels + (size_t)pending.uploadRow * w);
+        }
+        pending.uploadRow += rows;
+        pending.uploadedBytes += rowBytes * rows;
+        budget -= std::min(budget, rowBytes * rows);
+
+        if (pending.uploadRow < pageRows * pages)
+        {
+            if (budget == 0)
+                break;
+            continue;
+        }
+        pending.uploadRow = 0;
+        ++pending.uploadMip;
+        if (budget == 0)
+            break;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return pending.uploadMip >= levels;
+}
+
+// Uploads level 0 of one atlas page for the texture panel, a no-op when that
+// page is already shown the same way
+void SetPreviewPage(sleveldata_t& leveldata, int page, bool floatView)
+{
+    const level_t& level = leveldata.level;
+    if (!level.sheet.pixels || page < 0 || page >= (int)level.sheetPages)
+        return;
+    if (leveldata.previewTexid != 0 && leveldata.previewPage == page && leveldata.previewFloat == floatView)
+        return;
+
+    if (leveldata.previewTexid == 0)
+        glGenTextures(1, &leveldata.previewTexid);
+    leveldata.previewPage = page;
+    leveldata.previewFloat = floatView;
+
+    const texture_t pageTexture = { level.sheet.w, level.sheet.h, level.sheet.pixels + (size_t)page * level.sheet.w * level.sheet.h };
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, leveldata.previewTexid);
+    if (floatView)
+    {
+        auto pixels = ExpandTexture(pageTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pageTexture.w, pageTexture.h, 0, GL_RGBA, GL_FLOAT, pixels.data());
+    }
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pageTexture.w, pageTexture.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pageTexture.pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void SetPreviewSource(sleveldata_t& leveldata, int index)
+{
+    const level_t& level = leveldata.level;
+    if (index < 0 || index >= (int)level.textures.size() || !level.textures[index].pixels)
+        return;
+    if (leveldata.sourceTexid != 0 && leveldata.sourceIndex == index)
+        return;
+
+    if (leveldata.sourceTexid == 0)
+        glGenTextures(1, &leveldata.sourceTexid);
+    leveldata.sourceIndex = index;
+
+    const texture_t& texture = level.textures[index];
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, leveldata.sourceTexid);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture.w, texture.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+std::string levelPath, levelName;
+void FinishOpenLevel(pendinglevel_t& pending, sleveldata_t& leveldata)
+{
+    CloseLevel(leveldata);
+    std::swap(leveldata.level, pending.level);
+    std::swap(g_Scene, pending.scene);
+    leveldata.texid = pending.texid;
+    pending.texid = 0;
+
+    ::levelPath = pending.path;
     size_t fsi = ::levelPath.find_last_of("/");
     size_t bsi = ::levelPath.find_last_of("\\");
     if (fsi != std::string::npos || bsi != std::string::npos)
@@ -355,19 +894,30 @@ bool OpenLevel(const char* levelPath, sleveldata_t& leveldata)
     }
     levelName = leveldata.level.name;
     leveldata.open = true;
+    leveldata.instancesDirty = true;
+}
 
-    for (auto& m : leveldata.level.models)
-        mdls.push_back(createobj(m));
+// Advances the pending load by one frame's worth of work
+void UpdatePendingLevel(sleveldata_t& leveldata)
+{
+    ReapCancelledLevels(false);
+    if (!g_PendingLevel || !g_PendingLevel->workerDone)
+        return;
 
-    glGenTextures(1, &leveldata.texid);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, leveldata.texid);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, leveldata.level.sheet.w, leveldata.level.sheet.h, 0, GL_RGBA, GL_FLOAT, leveldata.level.sheet.pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!g_PendingLevel->loaded)
+    {
+        printf("Failed to load level \"%s\"\n", g_PendingLevel->path.c_str());
+        g_PendingLevel->worker.join();
+        g_PendingLevel.reset();
+        return;
+    }
 
-    return true;
+    if (UploadPendingLevel(*g_PendingLevel, c_UPLOADBYTESPERFRAME))
+    {
+        g_PendingLevel->worker.join();
+        FinishOpenLevel(*g_PendingLevel, leveldata);
+        g_PendingLevel.reset();
+    }
 }
 
 int main()
@@ -377,6 +927,20 @@ int main()
 
     glfwMakeContextCurrent(g_Window);
     gladLoadGL();
+    if (!LoadGLExtensions((GLADloadproc)glfwGetProcAddress))
+    {
+        printf("OpenGL 3.3 is required\n");
+        return 1;
+    }
+    g_HasS3TC = glfwExtensionSupported("GL_EXT_texture_compression_s3tc") == GLFW_TRUE;
+    g_HasRGB565 = (GLVersion.major == 4 && GLVersion.minor >= 1) || GLVersion.major > 4
+        || glfwExtensionSupported("GL_ARB_ES2_compatibility") == GLFW_TRUE;
+    // The commands start each model at its own base instance, which needs
+    // GL 4.2 or ARB_base_instance on top of multi-draw indirect
+    const bool hasBaseInstance = (GLVersion.major == 4 && GLVersion.minor >= 2) || GLVersion.major > 4
+        || glfwExtensionSupported("GL_ARB_base_instance") == GLFW_TRUE;
+    g_HasMultiDrawIndirect = glMultiDrawElementsIndirect != NULL && hasBaseInstance
+        && ((GLVersion.major == 4 && GLVersion.minor >= 3) || GLVersion.major > 4 || glfwExtensionSupported("GL_ARB_multi_draw_indirect") == GLFW_TRUE);
     glfwSetScrollCallback(g_Window, scroll_callback);
     glfwSetCursorPosCallback(g_Window, mouse_callback);
     glfwSetMouseButtonCallback(g_Window, mousebtn_callback);
@@ -395,21 +959,20 @@ int main()
     unsigned int program;
     if (!LoadShader(program, { "../data/shaders/basic.vert", "../data/shaders/basic.frag" }))
         return 1;
+    levelprogram_t levelProgram;
+    if (!InitLevelProgram(levelProgram, program))
+        return 1;
+    renderstats_t renderStats;
+    bool vsync = true;
 
     sleveldata_t leveldata;
 
-    std::vector<Vertex> vertices = {
-        {{-10, -10, 50}, {0.5f, 0.5f, 0.5f, 0.5f}, {1, 1}},
-        {{10, -10, 50}, {0.5f, 0.5f, 0.5f, 0.5f}, {0, 1}},
-        {{10, 10, 50}, {0.5f, 0.5f, 0.5f, 0.5f}, {0, 0}},
-        {{-10, -10, 50}, {0.5f, 0.5f, 0.5f, 0.5f}, {1, 1}},
-        {{10, 10, 50}, {0.5f, 0.5f, 0.5f, 0.5f}, {0, 0}},
-        {{-10, 10, 50}, {0.5f, 0.5f, 0.5f, 0.5f}, {1, 0}},
-    };
-
-    OpenLevel(R"(C:\Users\Matt\Desktop\level\Map5.dfx)", leveldata);
+    BeginOpenLevel(R"(C:\Users\Matt\Desktop\level\Map5.dfx)");
 
     bool showTexturePanel = false;
+    bool floatDebugView = false;
+    int texturePage = 0;
+    int sourceTexture = 0;
     float textureZoomScale = 1.f;
 
     bool toggleObjectsMenu = false;
@@ -452,22 +1015,28 @@ int main()
             }
         }
 
+        UpdatePendingLevel(leveldata);
+
         ImGui_ImplGlfw_NewFrame();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui::NewFrame();
 
-        for (size_t i = 0; i < leveldata.level.models.size(); ++i)
+        if (leveldata.instancesDirty)
         {
-            if (leveldata.level.models[i]->objectVisibility)
-                for (auto& inst : leveldata.level.models[i]->instances)
-                {
-                    if (inst.isVisible)
-                        mdls[i]->draw(program, leveldata, inst, leveldata.level.models[i]->name);
-                }
-            if (noObjects)
-                break;
+            // The level geometry is the first model
+            g_Scene.compact(leveldata.level.models, noObjects ? 1 : leveldata.level.models.size(), g_FrustumCulling);
+            leveldata.instancesDirty = false;
+            ++renderStats.compactions;
         }
 
+        const glm::mat4 viewProjection = GetViewProjection();
+        const double submitStart = glfwGetTime();
+        BeginLevelDraw(levelProgram, leveldata, viewProjection, renderStats);
+        g_Scene.cull(leveldata.level.models, viewProjection, g_FrustumCulling, renderStats);
+        g_Scene.draw(g_HasMultiDrawIndirect && g_UseMultiDraw, renderStats);
+        EndLevelDraw(renderStats);
+        renderStats.submitMs = (glfwGetTime() - submitStart) * 1000.0;
+
         ImGui::SetNextWindowPos({ 0, 0 });
         ImGui::SetNextWindowSize({ 240, (float)height });
         if (ImGui::Begin("Camera", NULL, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_AlwaysVerticalScrollbar))
@@ -483,8 +1052,25 @@ int main()
             ImGui::Separator();
             ImGui::Spacing();
             ImGui::Text("Stats:");
-            ImGui::Text("  Polygons: %d", leveldata.level.models.empty() ? 0 : leveldata.level.models[0]->polygons.size());
-            ImGui::Text("  Textures: %d", leveldata.level.textures.size() - 1);
+            ImGui::Text("  Polygons: %d", leveldata.level.models.empty() ? 0 : leveldata.level.models[0]->mesh.GetTriangleCount());
+            ImGui::Text("  Textures: %d", leveldata.level.list.size());
+            const meshstats_t& meshStats = leveldata.level.meshStats;
+            ImGui::Text("  Mesh VRAM: %.2f MB (unindexed %.2f MB)", meshStats.GetBytes() / (1024.f * 1024.f), meshStats.GetExpandedBytes() / (1024.f * 1024.f));
+            ImGui::Text("  Vertices: %zu for %zu corners", meshStats.vertices, meshStats.corners);
+            ImGui::Text("  Level chunks: %zu", leveldata.level.models.empty() ? 0 : leveldata.level.models[0]->mesh.chunks.size());
+            if (!leveldata.level.fromCache)
+                ImGui::Text("  Mesh build: %.2f ms", meshStats.buildMs);
+            if (leveldata.level.fromCache)
+                ImGui::Text("  Loaded from cache");
+            const scenedrawcounts_t& culling = renderStats.culling;
+            ImGui::Text("  Chunks drawn: %zu, culled: %zu", culling.levelChunksDrawn, culling.levelChunks - culling.levelChunksDrawn);
+            ImGui::Text("  Objects drawn: %zu, culled: %zu", culling.objectInstancesDrawn, culling.objectInstances - culling.objectInstancesDrawn);
+            ImGui::Text("  Culling: %.3f ms (%s)", renderStats.cullMs, Simd::GetLevelName(Simd::GetLevel()));
+            ImGui::Text("  Draws: %zu chunks, %zu instances", renderStats.draws, renderStats.instances);
+            ImGui::Text("  Draw calls: %zu", renderStats.submissions);
+            ImGui::Text("  Submit: %.3f ms, frame %.2f ms", renderStats.submitMs, 1000.f / ImGui::GetIO().Framerate);
+            ImGui::Text("  GL calls: %zu, ~%zu saved (est.)", renderStats.glCalls, renderStats.GetUnbatchedCalls() - std::min(renderStats.glCalls, renderStats.GetUnbatchedCalls()));
+            ImGui::Text("  Instance compactions: %zu", renderStats.compactions);
             ImGui::Spacing();
             ImGui::Separator();
             ImGui::Spacing();
@@ -508,13 +1094,37 @@ int main()
                 SetWireframe(wireframe);
             ImGui::Checkbox("Toggle Vertex Color?", &vertexCols);
             ImGui::Checkbox("Toggle Textures?", &texturesVis);
-            ImGui::Checkbox("Toggle Objects?", &noObjects);
+            if (ImGui::Checkbox("Toggle Objects?", &noObjects))
+                leveldata.instancesDirty = true;
             ImGui::Checkbox("Toggle Billboarding?", &enableBillboarding);
+            ImGui::Checkbox("Frustum culling", &g_FrustumCulling);
+            if (g_HasMultiDrawIndirect)
+                ImGui::Checkbox("Multi-draw indirect", &g_UseMultiDraw);
+            else
+                ImGui::TextDisabled("No multi-draw indirect");
+            if (ImGui::Checkbox("VSync", &vsync))
+                glfwSwapInterval(vsync ? 1 : 0);
             if (ImGui_CenteredButton("Open Level (*.dfx)"))
             {
                 auto path = OpenLoadPrompt("Gex 3D Level File (*.dfx)\0*.dfx\0All files (*.*)\0*.*\0");
                 if (!path.empty())
-                    OpenLevel(path.c_str(), leveldata);
+                    BeginOpenLevel(path);
+            }
+
+            if (g_PendingLevel)
+            {
+                auto& pending = *g_PendingLevel;
+                ImGui::Spacing();
+                ImGui::Text("Loading %s", pending.path.substr(pending.path.find_last_of("/\\") + 1).c_str());
+                if (pending.workerDone)
+                {
+                    float fraction = pending.totalBytes == 0 ? 0.f : pending.uploadedBytes / (float)pending.totalBytes;
+                    ImGui::ProgressBar(fraction, { -1, 0 }, "Uploading");
+                }
+                else
+                    ImGui::ProgressBar(pending.progress.stageFraction, { -1, 0 }, GetLoadStageName(pending.progress.stage));
+                if (ImGui_CenteredButton("Cancel Loading"))
+                    CancelPendingLevel();
             }
 
             if (ImGui_CenteredButton("Open Objects Panel"))
@@ -522,6 +1132,11 @@ int main()
                 toggleObjectsMenu = true;
             }
 
+            if (ImGui_CenteredButton("Open Texture Panel"))
+            {
+                showTexturePanel = true;
+            }
+
             if (ImGui_CenteredButton("Reset Camera"))
             {
                 g_CamPos = { 0, 0, 0 };
@@ -563,8 +1178,56 @@ int main()
             ImGui::SetNextWindowPos({ ImGui::GetWindowWidth() / 2.f, ImGui::GetWindowHeight() / 2.f }, ImGuiCond_Appearing);
             if (ImGui::Begin("Texture Atlas", &showTexturePanel, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_AlwaysVerticalScrollbar | ImGuiWindowFlags_AlwaysHorizontalScrollbar))
             {
-                ImGui::Text("Atlas Size: %lux%lu", leveldata.level.sheet.w, leveldata.level.sheet.h);
+                ImGui::Text("Atlas Size: %lux%lu, %u page(s), %u mip levels", leveldata.level.sheet.w, leveldata.level.sheet.h, leveldata.level.sheetPages, leveldata.level.sheetLevels);
                 ImGui::SliderFloat("Texture Zoom", &textureZoomScale, 1.f, 8.f, "%.0f");
+                if (leveldata.level.sheetPages > 1)
+                    ImGui::SliderInt("Page", &texturePage, 0, (int)leveldata.level.sheetPages - 1);
+                texturePage = std::clamp(texturePage, 0, std::max((int)leveldata.level.sheetPages - 1, 0));
+                ImGui::Checkbox("Float debug view", &floatDebugView);
+                SetPreviewPage(leveldata, texturePage, floatDebugView);
+                ImGui::Text("Packed textures: %zu", leveldata.level.list.size());
+                ImGui::Checkbox("Keep source textures on next load", &g_KeepTextures);
+                const level_t& level = leveldata.level;
+                const BlockFormat_t uploadFormat = GetUploadFormat(level);
+                const size_t rgbaBytes = GetAtlasTexelCount(level.sheet.w, level.sheet.h, level.sheetLevels, level.sheetPages) * sizeof(rgba8_t);
+                const size_t gpuBytes = GetAtlasBytes(level.sheet.w, level.sheet.h, level.sheetLevels, level.sheetPages, uploadFormat, level.atlasFormat);
+                ImGui::Text("GPU format: %s, %.1f MB (RGBA8 %.1f MB)", uploadFormat != BlockFormat_t::None ? GetBlockFormatName(uploadFormat) : GetAtlasFormatName(level.atlasFormat),
+                    gpuBytes / (1024.f * 1024.f), rgbaBytes / (1024.f * 1024.f));
+                if (g_HasS3TC)
+                    ImGui::Checkbox("Block compress on next load", &g_CompressTextures);
+                if (ImGui::InputInt("Texture budget (MB) on next load", &g_TextureBudgetMB))
+                    g_TextureBudgetMB = std::max(g_TextureBudgetMB, 0);
+                if (level.textureBudget != 0)
+                {
+                    ImGui::Text("Loaded with a %.1f MB budget%s", level.textureBudget / (1024.f * 1024.f), gpuBytes > level.textureBudget ? ", not met" : "");
+                    if (uploadFormat == BlockFormat_t::None && level.atlasFormat != AtlasFormat_t::RGBA8)
+                        ImGui::Text("Every texture reduced to %s", GetAtlasFormatName(level.atlasFormat));
+                }
+                if (!level.degradedTextures.empty() && ImGui::TreeNode("Downscaled", "%zu texture(s) downscaled", level.degradedTextures.size()))
+                {
+                    for (auto& degraded : level.degradedTextures)
+                    {
+                        ImGui::Text("Texture %u: %ux%u -> %ux%u, %u level(s) down, %s", degraded.texture, degraded.width, degraded.height,
+                            GetMipSize(degraded.width, degraded.droppedLevels), GetMipSize(degraded.height, degraded.droppedLevels), degraded.droppedLevels,
+                            degraded.storedLevel ? "stored LOD" : "box filtered");
+                    }
+                    ImGui::TreePop();
+                }
+                if (!level.textures.empty() && ImGui::TreeNode("Sources", "%zu source texture(s) kept", level.textures.size()))
+                {
+                    ImGui::SliderInt("Source", &sourceTexture, 0, (int)level.textures.size() - 1);
+                    sourceTexture = std::clamp(sourceTexture, 0, (int)level.textures.size() - 1);
+                    const texture_t& source = level.textures[sourceTexture];
+                    if (source.pixels)
+                    {
+                        SetPreviewSource(leveldata, sourceTexture);
+                        ImGui::Text("Texture %d: %ux%u", sourceTexture, source.w, source.h);
+                        ImGui::Image((ImTextureID)(uintptr_t)leveldata.sourceTexid, { source.w * textureZoomScale, source.h * textureZoomScale });
+                    }
+                    else
+                        ImGui::TextDisabled("Texture %d: not referenced, not decoded", sourceTexture);
+                    ImGui::TreePop();
+                }
                 ImGuiStyle& style = ImGui::GetStyle();
                 float ratio = 1.f;
                 if (ImGui::GetContentRegionAvail().x < ImGui::GetContentRegionAvail().y)
@@ -576,7 +1239,7 @@ int main()
                     ratio = (ImGui::GetContentRegionAvail().y - style.FramePadding.y * 2.f) / leveldata.level.sheet.h;
                 }
                 auto [cx, cy] = ImGui::GetCursorPos();
-                ImGui::Image((ImTextureID)leveldata.texid, { ratio * leveldata.level.sheet.w * textureZoomScale, (float)leveldata.level.sheet.h * ratio * textureZoomScale });
+                ImGui::Image((ImTextureID)(uintptr_t)leveldata.previewTexid, { ratio * leveldata.level.sheet.w * textureZoomScale, (float)leveldata.level.sheet.h * ratio * textureZoomScale });
                 ImGui::End();
             }
         }
@@ -592,12 +1255,14 @@ int main()
                 {
                     for (auto& mdl : leveldata.level.models)
                         mdl->objectVisibility = true;
+                    leveldata.instancesDirty = true;
                 }
                 ImGui::SameLine();
                 if (ImGui::Button("Hide All"))
                 {
                     for (auto& mdl : leveldata.level.models)
                         mdl->objectVisibility = false;
+                    leveldata.instancesDirty = true;
                 }
                 for (auto& mdl : leveldata.level.models)
                 {
@@ -610,19 +1275,22 @@ int main()
 
                     ImGui::BeginGroup();
                     ImGui::Indent(8.f);
-                    ImGui::Checkbox(("Visible?##" + std::to_string(mdl->addr)).c_str(), &mdl->objectVisibility);
+                    if (ImGui::Checkbox(("Visible?##" + std::to_string(mdl->addr)).c_str(), &mdl->objectVisibility))
+                        leveldata.instancesDirty = true;
                     ImGui::Text("Instances: %u", mdl->instances.size());
                     ImGui::Checkbox(("Show Instances List##" + std::to_string(mdl->addr)).c_str(), &mdl->showInstances);
                     if (ImGui::Button(("Show All##" + std::to_string(mdl->addr)).c_str()))
                     {
                         for (auto& inst : mdl->instances)
                             inst.isVisible = true;
+                        leveldata.instancesDirty = true;
                     }
                     ImGui::SameLine();
                     if (ImGui::Button(("Hide All##" + std::to_string(mdl->addr)).c_str()))
                     {
                         for (auto& inst : mdl->instances)
                             inst.isVisible = false;
+                        leveldata.instancesDirty = true;
                     }
                     if (mdl->showInstances)
                     {
@@ -631,7 +1299,8 @@ int main()
                         for (auto& inst : mdl->instances)
                         {
                             ImGui::Text("Pos: (%.0f, %.0f, %.0f) Rot: (%.0f, %.0f, %.0f)", -inst.position.x * 1000.f, inst.position.y * 1000.f, inst.position.z * 1000.f, inst.rotation.x * 180 / glm::pi<float>(), inst.rotation.y * 180 / glm::pi<float>(), inst.rotation.z * 180 / glm::pi<float>());
-                            ImGui::Checkbox(("Visible?##" + std::to_string(mdl->addr) + "_" + std::to_string(__i++)).c_str(), &inst.isVisible);
+                            if (ImGui::Checkbox(("Visible?##" + std::to_string(mdl->addr) + "_" + std::to_string(__i++)).c_str(), &inst.isVisible))
+                                leveldata.instancesDirty = true;
                             ImGui::Separator();
                         }
                         ImGui::Unindent(8.f);
@@ -654,9 +1323,11 @@ int main()
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
         glfwSwapBuffers(g_Window);
-        cameraInvalidated = true;
     }
 
+    CancelPendingLevel();
+    ReapCancelledLevels(true);
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -1,56 +1,17 @@
 #include "mapreader.h"
+#include "atlas.h"
+#include "filereader.h"
 #include "glideconstants.h"
-#include <bit>
+#include "levelcache.h"
+#include "texturedecoder.h"
+#include "threadpool.h"
+#include "vertexdecoder.h"
 #include <glm/ext/scalar_constants.hpp> // glm::pi
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <unordered_map>
-
-struct file_t
-{
-	using data_t = unsigned char;
-	data_t* data;
-	size_t size;
-	unsigned int baseOffset = 0;
-
-	template<typename T>
-	T Read(size_t offset, bool moveOffset = false)
-	{
-		T data = _Read<T>(baseOffset + offset);
-		if constexpr (std::endian::native == std::endian::big && sizeof(T) > 1)
-		{
-			using byte = unsigned char;
-			for (int i = 0; i < sizeof(T) >> 1; ++i)
-			{
-				static_cast<byte*>(&data)[i] ^= static_cast<byte*>(&data)[sizeof(T) - i - 1];
-				static_cast<byte*>(&data)[sizeof(T) - i - 1] ^= static_cast<byte*>(&data)[i];
-				static_cast<byte*>(&data)[i] ^= static_cast<byte*>(&data)[sizeof(T) - i - 1];
-			}
-		}
-		if (moveOffset)
-			baseOffset += sizeof(T) + offset;
-		return data;
-	}
-
-	~file_t()
-	{
-		delete[] data;
-		size = 0;
-	}
-	
-private:
-
-
-	template<typename T>
-	T _Read(size_t offset)
-	{
-#ifdef DEBUG
-		if (offset >= size)
-		{
-			printf("READ OUT OF BOUNDS! %x >= %x!\n", offset, size);
-		}
-#endif
-		return *(T*)(data + offset);
-	}
-};
+#include <unordered_set>
 
 void CreateCube(std::shared_ptr<Model> model)
 {
@@ -62,48 +23,38 @@ void CreateCube(std::shared_ptr<Model> model)
 	model->vertices.push_back({  100, -100,  100, 100, -100,  100, 0, 128, 128, 128, 255 });
 	model->vertices.push_back({  100,  100,  100, 100,  100,  100, 0, 128, 128, 128, 255 });
 	model->vertices.push_back({ -100,  100,  100,-100,  100,  100, 0, 128, 128, 128, 255 });
-	model->polygons.push_back({ {0, 1, 2}, 0, 0, {{0, 0}, {1, 0}, {1, 1}} });
-	model->polygons.push_back({ {0, 2, 3}, 0, 0, {{0, 0}, {1, 1}, {0, 1}} });
-	model->polygons.push_back({ {5, 4, 7}, 0, 0, {{0, 0}, {1, 0}, {1, 1}} });
-	model->polygons.push_back({ {5, 7, 6}, 0, 0, {{0, 0}, {1, 1}, {0, 1}} });
-	model->polygons.push_back({ {1, 5, 6}, 0, 0, {{0, 0}, {1, 0}, {1, 1}} });
-	model->polygons.push_back({ {1, 6, 2}, 0, 0, {{0, 0}, {1, 1}, {0, 1}} });
-	model->polygons.push_back({ {4, 0, 3}, 0, 0, {{0, 0}, {1, 0}, {1, 1}} });
-	model->polygons.push_back({ {4, 3, 7}, 0, 0, {{0, 0}, {1, 1}, {0, 1}} });
-	model->polygons.push_back({ {3, 2, 6}, 0, 0, {{0, 0}, {1, 0}, {1, 1}} });
-	model->polygons.push_back({ {3, 6, 7}, 0, 0, {{0, 0}, {1, 1}, {0, 1}} });
-	model->polygons.push_back({ {0, 1, 5}, 0, 0, {{0, 0}, {1, 0}, {1, 1}} });
-	model->polygons.push_back({ {0, 5, 4}, 0, 0, {{0, 0}, {1, 1}, {0, 1}} });
+	model->polygons.push_back({ {0, 1, 2}, 0, 0, {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}} });
+	model->polygons.push_back({ {0, 2, 3}, 0, 0, {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}} });
+	model->polygons.push_back({ {5, 4, 7}, 0, 0, {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}} });
+	model->polygons.push_back({ {5, 7, 6}, 0, 0, {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}} });
+	model->polygons.push_back({ {1, 5, 6}, 0, 0, {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}} });
+	model->polygons.push_back({ {1, 6, 2}, 0, 0, {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}} });
+	model->polygons.push_back({ {4, 0, 3}, 0, 0, {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}} });
+	model->polygons.push_back({ {4, 3, 7}, 0, 0, {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}} });
+	model->polygons.push_back({ {3, 2, 6}, 0, 0, {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}} });
+	model->polygons.push_back({ {3, 6, 7}, 0, 0, {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}} });
+	model->polygons.push_back({ {0, 1, 5}, 0, 0, {{0, 0, 0}, {1, 0, 0}, {1, 1, 0}} });
+	model->polygons.push_back({ {0, 5, 4}, 0, 0, {{0, 0, 0}, {1, 1, 0}, {0, 1, 0}} });
 }
 
-ImagePacker::ImageInformation_t* FindImageInfoById(ImagePacker::ImageInformationList& list, int id)
+void BuildMaterialLookup(level_t& level)
 {
-	if (auto it = std::find_if(list.begin(), list.end(), [id](const ImagePacker::ImageInformation_t& it)
-		{
-			return id == (int)it.userdata;
-		}); it != list.end())
+	level.materialLookup.clear();
+	for (size_t i = 0; i < level.list.size(); ++i)
 	{
-		return &*it;
+		const size_t id = (size_t)(uintptr_t)level.list[i].userdata;
+		if (id >= level.materialLookup.size())
+			level.materialLookup.resize(id + 1, -1);
+		level.materialLookup[id] = (int)i;
 	}
-
-	return nullptr;
 }
 
-bool ReadFile(const std::string& filepath, file_t& file)
+const ImagePacker::ImageInformation_t* FindImageInfoById(const level_t& level, unsigned int id)
 {
-	if (FILE* f = fopen(filepath.c_str(), "rb"))
-	{
-		fseek(f, 0, SEEK_END);
-		file.size = ftell(f);
-		fseek(f, 0, SEEK_SET);
-		file.data = new file_t::data_t[file.size];
-		fread(file.data, file.size, 1, f);
-		fclose(f);
-		return true;
-	}
+	if (id < level.materialLookup.size() && level.materialLookup[id] >= 0)
+		return &level.list[level.materialLookup[id]];
 
-	file.data = NULL;
-	return false;
+	return nullptr;
 }
 
 using byte = unsigned char;
@@ -113,12 +64,27 @@ using i16 = signed short;
 using i32 = signed int;
 using addr_t = u32;
 
+struct material_t
+{
+	glm::vec3 uvs[3];
+	u32 materialID;
+	u16 rawID;
+	bool hasImage;
+};
+
 struct levelext_t
 {
 	u32 dataOffset;
 	addr_t modelAddress;
 	u32 nObjects;
 	addr_t objAddress;
+
+	// Decoded material records, keyed by address. Many polygons share one.
+	std::unordered_map<addr_t, material_t> materials;
+	// Models already in level.models, keyed by address
+	std::unordered_map<addr_t, std::shared_ptr<Model>> modelIndex;
+
+	bool verbose = true;
 };
 
 struct geo_t
@@ -140,25 +106,52 @@ struct geo_t
 
 void ReadVertices(file_t& dfx, level_t& level, levelext_t& levelData, geo_t& geo, std::shared_ptr<Model> model)
 {
-	dfx.baseOffset = levelData.dataOffset + geo.vertexAddress;
-	for (u32 i = 0; i < geo.vertexCount; ++i)
+	const size_t start = levelData.dataOffset + geo.vertexAddress;
+	size_t count = geo.vertexCount;
+	if (start > dfx.size() || (dfx.size() - start) / c_VERTEXRECORDSIZE < count)
 	{
-		model->vertices.push_back(
-			{
-				dfx.Read<i16>(i * 12 + 0), dfx.Read<i16>(i * 12 + 4), (short)-dfx.Read<i16>(i * 12 + 2),
-				dfx.Read<i16>(i * 12 + 0), dfx.Read<i16>(i * 12 + 4), (short)-dfx.Read<i16>(i * 12 + 2),
-				dfx.Read<u16>(i * 12 + 6),
-				dfx.Read<byte>(i * 12 + 8), dfx.Read<byte>(i * 12 + 9), dfx.Read<byte>(i * 12 + 10), dfx.Read<byte>(i * 12 + 11)
-			});
+		printf("Vertex table at 0x%zX runs past the end of the file!\n", start);
+		count = start > dfx.size() ? 0 : (dfx.size() - start) / c_VERTEXRECORDSIZE;
+	}
+
+	const size_t first = model->vertices.size();
+	model->vertices.resize(first + count);
+	DecodeVertices(dfx.data.subspan(start), count, geo.isLevel, model->vertices.data() + first);
+}
 
-		if (!geo.isLevel)
+const material_t& ReadMaterial(file_t& dfx, level_t& level, levelext_t& levelData, addr_t materialAddr)
+{
+	auto [it, inserted] = levelData.materials.try_emplace(materialAddr);
+	material_t& material = it->second;
+	if (!inserted)
+		return material;
+
+	auto currOffset = dfx.baseOffset;
+	dfx.baseOffset = levelData.dataOffset + materialAddr;
+	material.uvs[0] = { dfx.Read<byte>(0) / 255.f, dfx.Read<byte>(1) / 255.f, 0.f };
+	material.uvs[1] = { dfx.Read<byte>(4) / 255.f, dfx.Read<byte>(5) / 255.f, 0.f };
+	material.uvs[2] = { dfx.Read<byte>(8) / 255.f, dfx.Read<byte>(9) / 255.f, 0.f };
+	material.rawID = dfx.Read<u16>(6);
+	material.materialID = material.rawID % 0x1000;
+	dfx.baseOffset = currOffset;
+
+	material.hasImage = false;
+	if (auto info = FindImageInfoById(level, material.materialID))
+	{
+		for (int j = 0; j < 3; ++j)
 		{
-			model->vertices.rbegin()[0].r = 128;
-			model->vertices.rbegin()[0].g = 128;
-			model->vertices.rbegin()[0].b = 128;
-			model->vertices.rbegin()[0].a = 255;
+			material.uvs[j].x *= info->width;
+			material.uvs[j].y *= info->height;
+			material.uvs[j].x += info->x;
+			material.uvs[j].y += info->y;
+			material.uvs[j].x /= (float)level.sheet.w;
+			material.uvs[j].y /= (float)level.sheet.h;
+			material.uvs[j].z = (float)info->page;
 		}
+		material.hasImage = true;
 	}
+
+	return material;
 }
 
 void ReadPolygons(file_t& dfx, level_t& level, levelext_t& levelData, geo_t& geo, std::shared_ptr<Model> model)
@@ -186,28 +179,9 @@ void ReadPolygons(file_t& dfx, level_t& level, levelext_t& levelData, geo_t& geo
 			addr_t materialAddr = dfx.Read<addr_t>(stride * i + 0x10);
 			if (materialAddr != 0xFFFF && (polygon.flags & 0x80) != 0x80)
 			{
-				auto currOffset = dfx.baseOffset;
-				dfx.baseOffset = levelData.dataOffset + materialAddr;
-				polygon.uvs[0] = { dfx.Read<byte>(0) / 255.f, dfx.Read<byte>(1) / 255.f };
-				polygon.uvs[1] = { dfx.Read<byte>(4) / 255.f, dfx.Read<byte>(5) / 255.f };
-				polygon.uvs[2] = { dfx.Read<byte>(8) / 255.f, dfx.Read<byte>(9) / 255.f };
-				polygon.materialID = dfx.Read<u16>(6) % 0x1000;
-
-
-				if (auto info = FindImageInfoById(level.list, polygon.materialID))
-				{
-					for (int j = 0; j < 3; ++j)
-					{
-						polygon.uvs[j].x *= info->width;
-						polygon.uvs[j].y *= info->height;
-						polygon.uvs[j].x += info->x;
-						polygon.uvs[j].y += info->y;
-						polygon.uvs[j].x /= (float)level.sheet.w;
-						polygon.uvs[j].y /= (float)level.sheet.h;
-					}
-				}
-
-				dfx.baseOffset = currOffset;
+				const material_t& material = ReadMaterial(dfx, level, levelData, materialAddr);
+				std::copy(std::begin(material.uvs), std::end(material.uvs), polygon.uvs);
+				polygon.materialID = material.materialID;
 			}
 			else
 			{
@@ -228,15 +202,15 @@ void ReadPolygons(file_t& dfx, level_t& level, levelext_t& levelData, geo_t& geo
 			if ((polygon.flags & 0x02) == 0x02)
 			{
 				addr_t materialAddr = dfx.Read<addr_t>(stride * i + 8);
-				auto currOffset = dfx.baseOffset;
-				dfx.baseOffset = levelData.dataOffset + materialAddr;
-				polygon.materialID = ((polygon.flags & 8) == 0) ? dfx.Read<u16>(6) : geo.textureAnimAddress;
+				const material_t& material = ReadMaterial(dfx, level, levelData, materialAddr);
+				polygon.materialID = ((polygon.flags & 8) == 0) ? material.rawID : geo.textureAnimAddress;
 				//if (materialAddr >= 0x1000)
 				//	printf("Material: (%X)|(%X) > %s\n", polygon.materialID / 0x1000, polygon.materialID % 0x1000, (polygon.flags & 8) ? "true" : "false");
 				addr_t was = 0;
 				if (model->name == "charger_" || model->name == "batt____" || model->name == "launch__")
 				{
-					printf("MAT: %d, FLG: %x\n", polygon.materialID, polygon.flags);
+					if (levelData.verbose)
+						printf("MAT: %d, FLG: %x\n", polygon.materialID, polygon.flags);
 				}
 				if ((polygon.flags & 8) == 8)
 				{
@@ -270,31 +244,14 @@ void ReadPolygons(file_t& dfx, level_t& level, levelext_t& levelData, geo_t& geo
 				
 				if (was == 0)
 				{
-					polygon.materialID = dfx.Read<u16>(6) % 0x1000;
+					polygon.materialID = material.materialID;
 				}
-				polygon.uvs[0] = { dfx.Read<byte>(0) / 255.f, dfx.Read<byte>(1) / 255.f };
-				polygon.uvs[1] = { dfx.Read<byte>(4) / 255.f, dfx.Read<byte>(5) / 255.f };
-				polygon.uvs[2] = { dfx.Read<byte>(8) / 255.f, dfx.Read<byte>(9) / 255.f };
+				std::copy(std::begin(material.uvs), std::end(material.uvs), polygon.uvs);
 
-				if (auto info = FindImageInfoById(level.list, polygon.materialID))
+				if (!material.hasImage)
 				{
-					for (int j = 0; j < 3; ++j)
-					{
-						polygon.uvs[j].x *= info->width;
-						polygon.uvs[j].y *= info->height;
-						polygon.uvs[j].x += info->x;
-						polygon.uvs[j].y += info->y;
-						polygon.uvs[j].x /= (float)level.sheet.w;
-						polygon.uvs[j].y /= (float)level.sheet.h;
-					}
+					printf("Can't find texture info for material 0x%X (%u)\n", polygon.materialID, polygon.materialID);
 				}
-				else
-				{
-					printf("Can't find texture info for material 0x%X (%lu)\n", polygon.materialID, polygon.materialID);
-				}
-				
-
-				dfx.baseOffset = currOffset;
 			}
 			else
 			{
@@ -326,15 +283,15 @@ void ReadLevelGeometry(file_t& dfx, level_t& level, levelext_t& levelData, addr_
 	dfx.baseOffset = levelData.dataOffset;
 }
 
-void ReadObjectGeometry(file_t& dfx, level_t& level, levelext_t& levelData, addr_t modelAddr)
+std::shared_ptr<Model> ReadObjectGeometry(file_t& dfx, level_t& level, levelext_t& levelData, addr_t modelAddr)
 {
 	dfx.baseOffset = modelAddr + levelData.dataOffset;
 	auto model = std::make_shared<Model>(modelAddr);
-	level.models.push_back(model);
 	addr_t modelNameAddr = dfx.Read<addr_t>(0x24);
 	char name[9] = { 0 };
-	memcpy(name, dfx.data + levelData.dataOffset + modelNameAddr, 8);
-	printf("Reading %s model data...\n", name);
+	memcpy(name, dfx.data.data() + levelData.dataOffset + modelNameAddr, 8);
+	if (levelData.verbose)
+		printf("Reading %s model data...\n", name);
 	model->name = name;
 
 	u16 objCount = dfx.Read<u16>(8);
@@ -357,7 +314,8 @@ void ReadObjectGeometry(file_t& dfx, level_t& level, levelext_t& levelData, addr
 
 		if (geo.textureAnimAddress != NULL)
 		{
-			printf("Animated textures detected (0x%X)!\n", geo.textureAnimAddress);
+			if (levelData.verbose)
+				printf("Animated textures detected (0x%X)!\n", geo.textureAnimAddress);
 			dfx.baseOffset = levelData.dataOffset + geo.textureAnimAddress;
 			//was = dfx.baseOffset;
 			//dfx.baseOffset = levelData.dataOffset + geo.textureAnimAddress;
@@ -400,29 +358,128 @@ void ReadObjectGeometry(file_t& dfx, level_t& level, levelext_t& levelData, addr
 		ReadVertices(dfx, level, levelData, geo, model);
 		ReadPolygons(dfx, level, levelData, geo, model);
 	}
+
+	return model;
 }
 
 void ReadObjectInstance(file_t& dfx, level_t& level, levelext_t& levelData, addr_t instanceAddr)
 {
 	dfx.baseOffset = 0;
 	addr_t modelAddr = dfx.Read<addr_t>(instanceAddr);
-	u32 modelIndex = 0;
-	for (auto& m : level.models)
+	std::shared_ptr<Model> model;
+	if (auto it = levelData.modelIndex.find(modelAddr); it != levelData.modelIndex.end())
 	{
-		if (m->addr == modelAddr)
-			break;
-		++modelIndex;
+		model = it->second;
+	}
+	else
+	{
+		model = ReadObjectGeometry(dfx, level, levelData, modelAddr);
+		level.models.push_back(model);
+		levelData.modelIndex.emplace(modelAddr, model);
 	}
 
-	if (modelIndex == level.models.size())
-		ReadObjectGeometry(dfx, level, levelData, modelAddr);
-	
 	dfx.baseOffset = instanceAddr;
 	constexpr float c_PI_2_FROM_1024 = glm::pi<float>() / 2048.f;
 	glm::vec3 rot = { dfx.Read<i16>(10) * c_PI_2_FROM_1024, dfx.Read<i16>(12) * -c_PI_2_FROM_1024, dfx.Read<i16>(14) * c_PI_2_FROM_1024 };
 	glm::vec3 pos = { -dfx.Read<i16>(16) * 0.001f, -dfx.Read<i16>(20) * 0.001f, dfx.Read<i16>(18) * 0.001f };
-	(*level.models.rbegin())->instances.push_back({ pos, rot });
+	model->instances.push_back({ pos, rot });
+}
 
+// Decodes every model referenced by the instance table across the thread pool.
+// Models are merged in order of first reference, same as a serial load.
+void ReadObjectModels(file_t& dfx, level_t& level, levelext_t& levelData, ThreadPool& pool)
+{
+	std::vector<addr_t> pending;
+	std::unordered_set<addr_t> seen;
+	for (u32 i = 0; i < levelData.nObjects; ++i)
+	{
+		dfx.baseOffset = 0;
+		addr_t modelAddr = dfx.Read<addr_t>(levelData.dataOffset + levelData.objAddress + 0x30 * i);
+		if (!levelData.modelIndex.contains(modelAddr) && seen.insert(modelAddr).second)
+			pending.push_back(modelAddr);
+	}
+
+	std::vector<std::shared_ptr<Model>> models(pending.size());
+	pool.ParallelFor(pending.size(), [&](size_t i)
+		{
+			// baseOffset and the material cache are per-cursor state
+			file_t cursor = dfx;
+			levelext_t workerData;
+			workerData.dataOffset = levelData.dataOffset;
+			workerData.modelAddress = levelData.modelAddress;
+			workerData.nObjects = levelData.nObjects;
+			workerData.objAddress = levelData.objAddress;
+			workerData.verbose = levelData.verbose;
+			models[i] = ReadObjectGeometry(cursor, level, workerData, pending[i]);
+		});
+
+	for (auto& model : models)
+	{
+		level.models.push_back(model);
+		levelData.modelIndex.emplace(model->addr, model);
+	}
+}
+
+// Marks the texture of every material the level geometry or an instanced
+// object uses, reading only polygon and material records so textures can be
+// packed before any geometry is decoded. Indexed by material ID.
+std::vector<bool> ScanMaterialReferences(file_t dfx, const levelext_t& levelData)
+{
+	std::vector<bool> used(0x1000, false);
+	dfx.baseOffset = 0;
+
+	// Reading the ID is cheaper than remembering which materials were seen
+	auto markMaterial = [&](addr_t materialAddr)
+		{
+			const size_t at = (size_t)levelData.dataOffset + materialAddr + 6;
+			if (at + sizeof(u16) <= dfx.size())
+				used[dfx.Read<u16>(at) % 0x1000] = true;
+		};
+
+	// Same material rules as ReadPolygons
+	auto scanPolygons = [&](addr_t polygonAddr, u32 count, bool isLevel)
+		{
+			const size_t stride = isLevel ? 0x14 : 0x0C;
+			const size_t start = (size_t)levelData.dataOffset + polygonAddr;
+			if (start > dfx.size())
+				return;
+			count = (u32)std::min<size_t>(count, (dfx.size() - start) / stride);
+			for (u32 i = 0; i < count; ++i)
+			{
+				const size_t polygon = start + stride * i;
+				const byte flags = dfx.Read<byte>(polygon + 7);
+				if (isLevel)
+				{
+					const addr_t materialAddr = dfx.Read<addr_t>(polygon + 0x10);
+					if (materialAddr != 0xFFFF && (flags & 0x80) != 0x80)
+						markMaterial(materialAddr);
+				}
+				else if ((flags & 0x02) == 0x02)
+					markMaterial(dfx.Read<addr_t>(polygon + 8));
+			}
+		};
+
+	const size_t geometry = (size_t)levelData.dataOffset + dfx.Read<addr_t>(levelData.dataOffset);
+	scanPolygons(dfx.Read<addr_t>(geometry + 0x28), dfx.Read<u32>(geometry + 0x1C), true);
+
+	std::unordered_set<addr_t> seenModels;
+	for (u32 i = 0; i < levelData.nObjects; ++i)
+	{
+		const addr_t modelAddr = dfx.Read<addr_t>(levelData.dataOffset + levelData.objAddress + 0x30 * i);
+		if (!seenModels.insert(modelAddr).second)
+			continue;
+
+		const size_t model = (size_t)levelData.dataOffset + modelAddr;
+		const u16 objCount = dfx.Read<u16>(model + 8);
+		const addr_t objStartAddr = dfx.Read<addr_t>(model + 12);
+		for (u16 j = 0; j < objCount; ++j)
+		{
+			const size_t object = (size_t)levelData.dataOffset + dfx.Read<addr_t>(levelData.dataOffset + objStartAddr + j * 4);
+			scanPolygons(dfx.Read<addr_t>(object + 20), dfx.Read<u16>(object + 16), false);
+		}
+	}
+
+	return used;
 }
 
 struct GexTex_t
@@ -452,27 +509,29 @@ auto GetImageSizeFromTexture(GrLOD_t lod, GrAspectRatio_t aspect)
 		u32 w, h;
 	};
 
-	const FxU32 magicNum = 256U >> lod;
+	// Like Glide, the short side of a narrow texture stops at one texel
+	const FxU32 magicNum = lod <= GR_LOD_1 ? 256U >> lod : 1;
+	auto narrow = [magicNum](u32 shift) { return std::max(magicNum >> shift, 1U); };
 
 	switch (aspect)
 	{
 	case GrAspectRatio_t::GR_ASPECT_8x1:
-		return size{ magicNum, magicNum >> 3 };
+		return size{ magicNum, narrow(3) };
 
 	case GrAspectRatio_t::GR_ASPECT_4x1:
-		return size{ magicNum, magicNum >> 2 };
+		return size{ magicNum, narrow(2) };
 
 	case GrAspectRatio_t::GR_ASPECT_2x1:
-		return size{ magicNum, magicNum >> 1 };
+		return size{ magicNum, narrow(1) };
 
 	case GrAspectRatio_t::GR_ASPECT_1x2:
-		return size{ magicNum >> 1, magicNum };
+		return size{ narrow(1), magicNum };
 
 	case GrAspectRatio_t::GR_ASPECT_1x4:
-		return size{ magicNum >> 2, magicNum };
+		return size{ narrow(2), magicNum };
 
 	case GrAspectRatio_t::GR_ASPECT_1x8:
-		return size{ magicNum >> 3, magicNum };
+		return size{ narrow(3), magicNum };
 
 	default:
 	case GrAspectRatio_t::GR_ASPECT_1x1:
@@ -480,214 +539,372 @@ auto GetImageSizeFromTexture(GrLOD_t lod, GrAspectRatio_t aspect)
 	}
 }
 
-glm::vec4* ConvertARGB4444(file_t& vfx, const GexTex_t& tex)
+struct vfxentry_t
 {
-	auto [w, h] = GetImageSizeFromTexture(tex.info.largeLod, tex.info.aspectRatio);
+	GexTex_t tex;
+	u32 dataOffset; // Offset of the large LOD texels in the .vfx
+	u32 width, height;
+};
 
-	glm::vec4* buffer = new glm::vec4[w * h];
+using vfxdirectory_t = std::vector<vfxentry_t>;
 
-	for (size_t i = 0; i < tex.largeLodBytes / 2; ++i)
-	{
-		FxU16 pixel_data = vfx.Read<FxU16>(0, true);
-#pragma warning(push)
-#pragma warning(disable: 6386)
-		buffer[i] = {
-			(FxU8)(((pixel_data & 0x0F00) >> 8) * 0x11),
-			(FxU8)(((pixel_data & 0x00F0) >> 4) * 0x11),
-			(FxU8)(((pixel_data & 0x000F)) * 0x11),
-			(FxU8)(((pixel_data & 0xF000) >> 12) * 0x11)
-		};
-#pragma warning(pop)
-	}
+// Texture record layout: a 0x8C byte header followed by largeLodBytes of texels
+constexpr u32 c_VFXHEADERSIZE = 0x8C;
 
-	return buffer;
-}
-
-glm::vec4* ConvertARGB1555(file_t& vfx, const GexTex_t& tex)
+// Walks the .vfx headers once, recording where each texture lives so any of
+// them can be decoded without parsing the ones before it.
+bool ReadTextureDirectory(file_t vfx, vfxdirectory_t& directory)
 {
-	auto [w, h] = GetImageSizeFromTexture(tex.info.largeLod, tex.info.aspectRatio);
+	directory.clear();
+	vfx.baseOffset = 0;
+	if (vfx.size() < sizeof(u32))
+		return false;
 
-	glm::vec4* buffer = new glm::vec4[w * h];
+	u32 numTex = vfx.Read<u32>(0);
+	directory.reserve(numTex);
 
-	for (size_t i = 0; i < tex.largeLodBytes / 2; ++i)
+	size_t offset = sizeof(u32);
+	for (u32 i = 0; i < numTex; ++i)
 	{
-		FxU16 pixel_data = vfx.Read<FxU16>(0, true);
-#pragma warning(push)
-#pragma warning(disable: 6386)
-		buffer[i] = {
-			(FxU8)(((pixel_data >> 10) & 0x1F) * 0x08),
-			(FxU8)(((pixel_data >> 5) & 0x1F) * 0x08),
-			(FxU8)(((pixel_data) & 0x1F) * 0x8),
-			(FxU8)(((pixel_data & 0x8000) ? 0xFF : 0x00))
-		};
-#pragma warning(pop)
+		if (offset + c_VFXHEADERSIZE > vfx.size())
+		{
+			printf("Texture directory truncated at %u of %u textures\n", i, numTex);
+			break;
+		}
+
+		vfxentry_t entry;
+		GexTex_t& tex = entry.tex;
+		vfx.baseOffset = (unsigned int)offset;
+		tex.info.smallLod = vfx.Read<GrLOD_t>(0x00);
+		tex.info.largeLod = vfx.Read<GrLOD_t>(0x04);
+		tex.info.aspectRatio = vfx.Read<GrAspectRatio_t>(0x08);
+		tex.info.format = vfx.Read<GrTextureFormat_t>(0x0C);
+		if (tex.info.smallLod > GR_LOD_1 || tex.info.largeLod > GR_LOD_1 || tex.info.aspectRatio > GR_ASPECT_1x8)
+		{
+			printf("Texture %u has an invalid LOD or aspect ratio\n", i);
+			break;
+		}
+		// 0x10: addr, unused
+		for (int j = 0; j < 16; ++j)
+			tex.ncctable.yRGB[j] = vfx.Read<FxU8>(0x14 + j);
+
+		for (int y = 0; y < 4; ++y)
+			for (int x = 0; x < 3; ++x)
+				tex.ncctable.iRGB[y][x] = vfx.Read<FxI16>(0x24 + (y * 3 + x) * 2);
+
+		for (int y = 0; y < 4; ++y)
+			for (int x = 0; x < 3; ++x)
+				tex.ncctable.qRGB[y][x] = vfx.Read<FxI16>(0x3C + (y * 3 + x) * 2);
+
+		for (int j = 0; j < 12; ++j)
+			tex.ncctable.packed_data[j] = vfx.Read<FxU32>(0x54 + j * 4);
+
+		tex.smallLodBytes = vfx.Read<FxU32>(0x84);
+		tex.largeLodBytes = vfx.Read<FxU32>(0x88);
+
+		entry.dataOffset = (u32)(offset + c_VFXHEADERSIZE);
+		if (entry.dataOffset + (size_t)tex.largeLodBytes > vfx.size())
+		{
+			printf("Texture %u runs past the end of the file\n", i);
+			break;
+		}
+
+		auto [w, h] = GetImageSizeFromTexture(tex.info.largeLod, tex.info.aspectRatio);
+		entry.width = w;
+		entry.height = h;
+		directory.push_back(entry);
+
+		offset = entry.dataOffset + (size_t)tex.largeLodBytes;
 	}
 
-	return buffer;
+	return true;
 }
 
-glm::vec4* ConvertYIQ422(file_t& vfx, const GexTex_t& tex)
+// A texture with its tables built and texels located, so any band of its
+// rows decodes independently of the others
+struct texturejob_t
 {
-	auto [w, h] = GetImageSizeFromTexture(tex.info.largeLod, tex.info.aspectRatio);
+	GrTextureFormat_t format;
+	size_t texelSize;
+	std::span<const unsigned char> texels;
+	// Of the large LOD, which may be short
+	size_t texelCount;
+	// Complete levels in `texels`, the large LOD counts as one
+	unsigned int storedLevels;
+	texturetables_t tables;
+	texture_t texture;
+	const ImagePacker::ImageInformation_t* info;
+	// Of the image in level 0 of the atlas, with its page's rows before it
+	int x, y;
+	// Set when the budget shrinks the texture past its smallest stored level.
+	// The texels are then decoded whole at decodedWidth x decodedHeight and
+	// box filtered down this many times.
+	unsigned int filterLevels = 0;
+	unsigned int decodedWidth = 0, decodedHeight = 0;
+};
 
-	glm::vec4* buffer = new glm::vec4[w * h];
+// Textures that are not kept get no image of their own and decode straight
+// into the sheet. `droppedLevels` starts the texture further down its chain,
+// from the stored level where there is one.
+bool PrepareTexture(const file_t& vfx, const vfxentry_t& entry, unsigned int droppedLevels, bool keepTexture, texturejob_t& job)
+{
+	const GexTex_t& tex = entry.tex;
+	job.format = tex.info.format;
+	job.texelSize = GetTexelSize(job.format);
+	job.texture = { entry.width, entry.height, NULL };
+	if (job.texelSize == 0)
+	{
+		printf("Unknown type: %d\n", job.format);
+		return false;
+	}
 
-	GexTex_t::NCCTable_t ncc;
-	const GexTex_t::NCCTable_t* ncc1 = &tex.ncctable;
-	memcpy(&ncc, ncc1, sizeof(GexTex_t::NCCTable_t));
+	job.texels = vfx.data.subspan(entry.dataOffset, tex.largeLodBytes);
+	if (UsesYIQTable(job.format))
+		BuildYIQTable(tex.ncctable.yRGB, tex.ncctable.iRGB, tex.ncctable.qRGB, job.tables.yiq);
 
-	for (int i = 0; i < 4; ++i)
+	if (UsesPalette(job.format))
 	{
-		if (ncc.iRGB[i][0] & 0x100)
-			ncc.iRGB[i][0] |= 0xff00;
-		if (ncc.iRGB[i][1] & 0x100)
-			ncc.iRGB[i][1] |= 0xff00;
-		if (ncc.iRGB[i][2] & 0x100)
-			ncc.iRGB[i][2] |= 0xff00;
-
-		if (ncc.qRGB[i][0] & 0x100)
-			ncc.qRGB[i][0] |= 0xff00;
-		if (ncc.qRGB[i][1] & 0x100)
-			ncc.qRGB[i][1] |= 0xff00;
-		if (ncc.qRGB[i][2] & 0x100)
-			ncc.qRGB[i][2] |= 0xff00;
+		if (job.texels.size() < c_PALETTEBYTES)
+		{
+			printf("Palette texture is missing its palette\n");
+			return false;
+		}
+		BuildPaletteTable(job.texels.first(c_PALETTEBYTES), job.tables.palette);
+		job.texels = job.texels.subspan(c_PALETTEBYTES);
 	}
 
-	for (size_t i = 0; i < tex.largeLodBytes; ++i)
-	{
-		FxU8 in = vfx.Read<FxU8>(0, true);
+	// Short texel data leaves the rest of the image transparent black
+	job.texelCount = std::min<size_t>((size_t)entry.width * entry.height, job.texels.size() / job.texelSize);
 
-		FxI32 R = (FxI32)ncc.yRGB[in >> 4] + ncc.iRGB[(in >> 2) & 0x3][0]
-			+ ncc.qRGB[(in) & 0x3][0];
+	// A record covering several LODs stores each smaller level after the large one
+	const unsigned int chainLevels = tex.info.smallLod > tex.info.largeLod ? tex.info.smallLod - tex.info.largeLod + 1 : 1;
+	job.storedLevels = 1;
+	while (job.storedLevels < chainLevels && GetAtlasTexelCount(entry.width, entry.height, job.storedLevels + 1) * job.texelSize <= job.texels.size())
+		++job.storedLevels;
 
-		FxI32 G = (FxI32)ncc.yRGB[in >> 4] + ncc.iRGB[(in >> 2) & 0x3][1]
-			+ ncc.qRGB[(in) & 0x3][1];
+	if (droppedLevels != 0)
+	{
+		const unsigned int start = std::min(droppedLevels, job.storedLevels - 1);
+		job.decodedWidth = GetMipSize(entry.width, start);
+		job.decodedHeight = GetMipSize(entry.height, start);
+		if (start != 0)
+		{
+			job.texels = job.texels.subspan(GetAtlasTexelCount(entry.width, entry.height, start) * job.texelSize);
+			job.texelCount = (size_t)job.decodedWidth * job.decodedHeight;
+			job.storedLevels -= start;
+		}
+		job.filterLevels = droppedLevels - start;
+		job.texture.w = GetMipSize(entry.width, droppedLevels);
+		job.texture.h = GetMipSize(entry.height, droppedLevels);
+	}
 
-		FxI32 B = (FxI32)ncc.yRGB[in >> 4] + ncc.iRGB[(in >> 2) & 0x3][2]
-			+ ncc.qRGB[(in) & 0x3][2];
+	if (keepTexture)
+		job.texture.pixels = new rgba8_t[(size_t)job.texture.w * job.texture.h];
+	return true;
+}
 
-		R = ((R < 0) ? 0 : ((R > 255) ? 255 : R));
-		G = ((G < 0) ? 0 : ((G > 255) ? 255 : G));
-		B = ((B < 0) ? 0 : ((B > 255) ? 255 : B));
+void BlitRows(texture_t& dst, const texture_t& src, int x, int y, u32 firstRow, u32 rowCount)
+{
+	for (u32 yi = firstRow; yi < firstRow + rowCount; ++yi)
+		memcpy(dst.pixels + (size_t)(y + yi) * dst.w + x, src.pixels + (size_t)yi * src.w, src.w * sizeof(rgba8_t));
+}
 
-#pragma warning(push)
-#pragma warning(disable: 6386)
-		buffer[i] = {
-			(FxU8)(R), (FxU8)(G), (FxU8)(B), 0xFF
-		};
-#pragma warning(pop)
+// Decodes texels [first, first + count) of the image, those past the end of
+// the texel data are transparent black
+void DecodeTexelRange(const texturejob_t& job, size_t first, size_t count, rgba8_t* out)
+{
+	const size_t available = first < job.texelCount ? std::min(count, job.texelCount - first) : 0;
+	if (available != 0)
+		DecodeTexels(job.format, job.texels.subspan(first * job.texelSize), available, job.tables, out);
+	std::fill(out + available, out + count, rgba8_t{ 0, 0, 0, 0 });
+}
 
-		++in;
+// Decodes the texels whole and box filters them down to the packed size
+void DecodeFilteredTexture(texturejob_t& job, texture_t& sheet)
+{
+	std::vector<rgba8_t> pixels((size_t)job.decodedWidth * job.decodedHeight), filtered;
+	DecodeTexelRange(job, 0, pixels.size(), pixels.data());
+	texture_t image = { job.decodedWidth, job.decodedHeight, pixels.data() };
+	for (unsigned int i = 0; i < job.filterLevels; ++i)
+	{
+		filtered.resize((size_t)GetMipSize(image.w, 1) * GetMipSize(image.h, 1));
+		texture_t half = { GetMipSize(image.w, 1), GetMipSize(image.h, 1), filtered.data() };
+		DownsampleRows(image, half, 0, half.h);
+		pixels.swap(filtered);
+		image = { half.w, half.h, pixels.data() };
 	}
 
-	return buffer;
+	if (job.texture.pixels)
+		memcpy(job.texture.pixels, image.pixels, (size_t)image.w * image.h * sizeof(rgba8_t));
+	BlitRows(sheet, image, job.x, job.y, 0, image.h);
 }
 
-glm::vec4* ReadTexture(file_t& vfx, const GexTex_t& tex)
+// Touches only these rows of the texture and of its rectangle in level 0 of
+// the atlas, all pages included. Filtered textures come as a single band.
+void DecodeTextureRows(texturejob_t& job, texture_t& sheet, u32 firstRow, u32 rowCount)
 {
-	switch (tex.info.format)
+	if (job.filterLevels != 0)
 	{
-	case GrTextureFormat_t::GR_TEXFMT_ARGB_4444:
-		return ConvertARGB4444(vfx, tex);
+		DecodeFilteredTexture(job, sheet);
+		return;
+	}
 
-	case GrTextureFormat_t::GR_TEXFMT_ARGB_1555:
-		return ConvertARGB1555(vfx, tex);
+	const size_t w = job.texture.w;
+	if (job.texture.pixels == NULL)
+	{
+		for (u32 row = firstRow; row < firstRow + rowCount; ++row)
+			DecodeTexelRange(job, row * w, w, sheet.pixels + (size_t)(job.y + row) * sheet.w + job.x);
+		return;
+	}
 
-	case GrTextureFormat_t::GR_TEXFMT_YIQ_422:
-		return ConvertYIQ422(vfx, tex);
+	DecodeTexelRange(job, firstRow * w, rowCount * w, job.texture.pixels + firstRow * w);
+	BlitRows(sheet, job.texture, job.x, job.y, firstRow, rowCount);
+}
 
-	default:
-		printf("Unknown type: %d\n", tex.info.format);
-		return NULL;
+// Writes level `mip` of the texture into its rectangle of that atlas level:
+// the level stored in the .vfx if there is one, else what the box filter of
+// the level above left there. Then refills the gutter from the new edges.
+void PlaceTextureMip(const texturejob_t& job, texture_t& atlasLevel, unsigned int mip)
+{
+	const int x = job.x >> mip;
+	const int y = job.y >> mip;
+	const unsigned int w = GetMipSize(job.texture.w, mip);
+	const unsigned int h = GetMipSize(job.texture.h, mip);
+	if (mip != 0 && mip < job.storedLevels)
+	{
+		const size_t first = GetAtlasTexelCount(job.texture.w, job.texture.h, mip);
+		for (unsigned int row = 0; row < h; ++row)
+			DecodeTexels(job.format, job.texels.subspan((first + (size_t)row * w) * job.texelSize), w, job.tables, atlasLevel.pixels + (size_t)(y + row) * atlasLevel.w + x);
 	}
+	ExtendGutter(atlasLevel, x, y, w, h, c_ATLASGUTTER >> mip);
 }
 
-void BlitTex(texture_t& dst, const texture_t& src, int x, int y)
+// Texels per work item: large textures split into row bands so a few big
+// ones don't leave cores idle, small ones stay whole
+constexpr size_t c_TEXTUREBANDTEXELS = 16 * 1024;
+
+// 64 texel magenta checks behind the packed textures, filled a row band at a time
+void FillCheckerboard(texture_t& sheet, ThreadPool& pool)
 {
-	for (u32 yi = 0; yi < src.h; ++yi)
+	std::vector<rgba8_t> rows[2];
+	for (u32 parity = 0; parity < 2; ++parity)
 	{
-		for (u32 xi = 0; xi < src.w; ++xi)
-		{
-			dst.pixels[(y + yi) * dst.w + (x + xi)] = src.pixels[yi * src.w + xi];
-		}
+		rows[parity].resize(sheet.w);
+		for (u32 x = 0; x < sheet.w; ++x)
+			rows[parity][x] = ((x / 64) % 2) == parity ? rgba8_t{ 255, 0, 255, 255 } : rgba8_t{ 128, 0, 128, 255 };
 	}
+
+	pool.ParallelFor((sheet.h + 63) / 64, [&](size_t band)
+		{
+			const std::vector<rgba8_t>& row = rows[band % 2];
+			for (u32 y = (u32)band * 64; y < std::min<u32>((u32)band * 64 + 64, sheet.h); ++y)
+				memcpy(sheet.pixels + (size_t)y * sheet.w, row.data(), sheet.w * sizeof(rgba8_t));
+		});
 }
 
-void LoadTextures(const std::string& filepath, level_t& level)
+static ThreadPool& GetLoadPool(const loadoptions_t& options)
 {
-	file_t vfx;
-	if (!ReadFile(filepath, vfx))
-		return;
-
-	u32 numTex = vfx.Read<u32>(0);
+	return options.pool ? *options.pool : ThreadPool::Get();
+}
 
-	vfx.baseOffset = 4;
-	GexTex_t gexTex;
-	for (u32 i = 0; i < numTex; ++i)
+// Decodes the textures packed into the sheet, the others are skipped
+bool LoadTextures(const file_t& vfx, const vfxdirectory_t& directory, level_t& level, const loadoptions_t& options)
+{
+	ThreadPool& pool = GetLoadPool(options);
+	loadprogress_t* progress = options.progress;
+	std::vector<texturejob_t> jobs(directory.size());
+	std::vector<unsigned int> droppedLevels(directory.size(), 0);
+	for (auto& degraded : level.degradedTextures)
 	{
-		gexTex.info.smallLod = vfx.Read<GrLOD_t>(0, true);
-		gexTex.info.largeLod = vfx.Read<GrLOD_t>(0, true);
-		gexTex.info.aspectRatio = vfx.Read<GrAspectRatio_t>(0, true);
-		gexTex.info.format = vfx.Read<GrTextureFormat_t>(0, true);
-		(void)vfx.Read<FxU32>(0, true); // addr
-		for (int i = 0; i < 16; ++i)
-			gexTex.ncctable.yRGB[i] = vfx.Read<FxU8>(0, true);
+		if (degraded.texture < directory.size())
+			droppedLevels[degraded.texture] = degraded.droppedLevels;
+	}
 
-		for (int y = 0; y < 4; ++y)
-			for (int x = 0; x < 3; ++x)
-				gexTex.ncctable.iRGB[y][x] = vfx.Read<FxI16>(0, true);
+	pool.ParallelFor(jobs.size(), [&](size_t i)
+		{
+			jobs[i].texture = { directory[i].width, directory[i].height, NULL };
+			const ImagePacker::ImageInformation_t* info = FindImageInfoById(level, (u32)i);
+			if (info && PrepareTexture(vfx, directory[i], droppedLevels[i], options.keepTextures, jobs[i]))
+			{
+				jobs[i].info = info;
+				jobs[i].x = info->x;
+				jobs[i].y = info->page * (int)level.sheet.h + info->y;
+			}
+		});
 
-		for (int y = 0; y < 4; ++y)
-			for (int x = 0; x < 3; ++x)
-				gexTex.ncctable.qRGB[y][x] = vfx.Read<FxI16>(0, true);
+	for (auto& degraded : level.degradedTextures)
+		degraded.storedLevel = degraded.texture < jobs.size() && jobs[degraded.texture].info && jobs[degraded.texture].filterLevels == 0;
 
-		for (int i = 0; i < 12; ++i)
-			gexTex.ncctable.packed_data[i] = vfx.Read<FxU32>(0, true);
+	struct band_t
+	{
+		u32 job;
+		u32 firstRow;
+		u32 rowCount;
+	};
+	std::vector<band_t> bands;
+	for (u32 i = 0; i < jobs.size(); ++i)
+	{
+		const texture_t& texture = jobs[i].texture;
+		if (jobs[i].info == NULL)
+			continue;
 
-		gexTex.smallLodBytes = vfx.Read<FxU32>(0, true);
-		gexTex.largeLodBytes = vfx.Read<FxU32>(0, true);
+		const u32 bandRows = jobs[i].filterLevels != 0 ? texture.h : (u32)std::max<size_t>(1, c_TEXTUREBANDTEXELS / std::max(texture.w, 1U));
+		for (u32 row = 0; row < texture.h; row += bandRows)
+			bands.push_back({ i, row, std::min(bandRows, texture.h - row) });
+	}
 
-		auto t = ReadTexture(vfx, gexTex);
-		auto [w, h] = GetImageSizeFromTexture(gexTex.info.largeLod, gexTex.info.aspectRatio);
-		if (t != NULL)
+	texture_t atlas = GetAtlasLevel(level.sheet, 0, level.sheetPages);
+	std::atomic<size_t> bandsDone = 0;
+	pool.ParallelFor(bands.size(), [&](size_t i)
 		{
-			for (u32 ii = 0; ii < w * h; ++ii)
-			{
-				auto& pixel = t[ii];
-				pixel.r /= 255.f;
-				pixel.g /= 255.f;
-				pixel.b /= 255.f;
-				pixel.a /= 255.f;
-			}
-		}
-		if (auto info = FindImageInfoById(level.list, i))
+			if (progress && progress->cancelled)
+				return;
+
+			const band_t& band = bands[i];
+			DecodeTextureRows(jobs[band.job], atlas, band.firstRow, band.rowCount);
+			if (progress)
+				progress->stageFraction = ++bandsDone / (float)bands.size();
+		});
+
+	for (unsigned int mip = 0; mip < level.sheetLevels && !(progress && progress->cancelled); ++mip)
+	{
+		texture_t atlasLevel = GetAtlasLevel(level.sheet, mip, level.sheetPages);
+		if (mip != 0)
 		{
-			BlitTex(level.sheet, texture_t{ w, h, t }, info->x, info->y);
+			const texture_t above = GetAtlasLevel(level.sheet, mip - 1, level.sheetPages);
+			const u32 bandRows = (u32)std::max<size_t>(1, c_TEXTUREBANDTEXELS / std::max(atlasLevel.w, 1U));
+			pool.ParallelFor((atlasLevel.h + bandRows - 1) / bandRows, [&](size_t band)
+				{
+					const u32 firstRow = (u32)band * bandRows;
+					DownsampleRows(above, atlasLevel, firstRow, std::min(bandRows, atlasLevel.h - firstRow));
+				});
 		}
-		//delete[] t;
-		level.textures.push_back(texture_t{ w, h, t });
+
+		pool.ParallelFor(jobs.size(), [&](size_t i)
+			{
+				if (jobs[i].info)
+					PlaceTextureMip(jobs[i], atlasLevel, mip);
+			});
 	}
+
+	// Handed over even when cancelled so UnloadLevel frees them
+	if (options.keepTextures)
+	{
+		level.textures.reserve(jobs.size());
+		for (auto& job : jobs)
+			level.textures.push_back(job.texture);
+	}
+
+	return !(progress && progress->cancelled);
 }
 
-bool GetTextureInformation(const std::string& filepath, ImagePacker::ImageInformationList& list)
+void GetTextureInformation(const vfxdirectory_t& directory, const std::vector<bool>& used, ImagePacker::ImageInformationList& list)
 {
-	file_t f;
-	if (ReadFile(filepath, f))
+	for (u32 i = 0; i < directory.size() && i < used.size(); ++i)
 	{
-		u32 nFiles = f.Read<u32>(0, true);
-		for (u32 i = 0; i < nFiles; ++i)
-		{
-			GrLOD_t lod = f.Read<GrLOD_t>(sizeof(GrLOD_t), true);
-			GrAspectRatio_t asp = f.Read<GrAspectRatio_t>(0, true);
-			// Skip data
-			(void)f.Read<u32>(f.Read<u32>(0x7C, true) - 4, true);
-
-			auto [w, h] = GetImageSizeFromTexture(lod, asp);
-			list.push_back({ (int)w, (int)h, (void*)i });
-		}
-		return true;
+		if (used[i])
+			list.push_back({ (int)directory[i].width, (int)directory[i].height, (void*)(uintptr_t)i });
 	}
-	return false;
 }
 
 std::string GetLevelName(const std::string& levelStr, u32 dataOffsetRaw)
@@ -786,59 +1003,262 @@ std::string GetLevelName(const std::string& levelStr, u32 dataOffsetRaw)
 	return "Unknown Level";
 }
 
-bool LoadLevel(const std::string& filepath, level_t& level)
+void UnloadLevel(level_t& level)
 {
+	for (auto& tex : level.textures)
+		delete[] tex.pixels;
+	level.textures.clear();
+	if (!level.fromCache)
+		delete[] level.sheet.pixels;
+	level.sheet = { 0, 0, NULL };
+	level.sheetLevels = 0;
+	level.sheetPages = 0;
+	level.compressedFormat = BlockFormat_t::None;
+	level.compressedSheet = {};
+	level.compressedStorage = {};
+	level.atlasFormat = AtlasFormat_t::RGBA8;
+	level.degradedTextures.clear();
+	level.textureBudget = 0;
+	level.meshStats = {};
+	level.models.clear();
+	level.list.clear();
+	level.materialLookup.clear();
+	level.name.clear();
+	level.fromCache = false;
+	level.cookedData.reset();
+}
+
+std::vector<glm::vec4> ExpandTexture(const texture_t& texture)
+{
+	std::vector<glm::vec4> pixels((size_t)texture.w * texture.h);
+	for (size_t i = 0; i < pixels.size(); ++i)
+	{
+		const rgba8_t& p = texture.pixels[i];
+		pixels[i] = { p.r / 255.f, p.g / 255.f, p.b / 255.f, p.a / 255.f };
+	}
+	return pixels;
+}
+
+const char* GetLoadStageName(LoadStage_t stage)
+{
+	switch (stage)
+	{
+	case LoadStage_t::Queued: return "Queued";
+	case LoadStage_t::Cache: return "Checking cache";
+	case LoadStage_t::Directory: return "Reading texture directory";
+	case LoadStage_t::Textures: return "Decoding textures";
+	case LoadStage_t::Compression: return "Compressing textures";
+	case LoadStage_t::Geometry: return "Reading geometry";
+	case LoadStage_t::Instances: return "Placing instances";
+	case LoadStage_t::Meshes: return "Building meshes";
+	case LoadStage_t::Done: return "Done";
+	case LoadStage_t::Cancelled: return "Cancelled";
+	case LoadStage_t::Failed: return "Failed";
+	}
+	return "";
+}
+
+// Publishes `stage` and returns false if the load should stop
+static bool EnterStage(const loadoptions_t& options, LoadStage_t stage)
+{
+	if (!options.progress)
+		return true;
+
+	options.progress->stageFraction = 0.f;
+	options.progress->stage = stage;
+	return !options.progress->cancelled;
+}
+
+// Charges the time since the previous lap to one loadtimings_t field
+struct laptimer_t
+{
+	loadtimings_t* timings;
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+	void Lap(double loadtimings_t::* stage)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (timings)
+			timings->*stage += std::chrono::duration<double, std::milli>(now - last).count();
+		last = now;
+	}
+};
+
+static bool LoadLevelImpl(const std::string& filepath, level_t& level, const loadoptions_t& options);
+
+// Whether a cooked level's atlas is the one these options would build. A
+// budget is planned for the compressed size when there is one.
+static bool MatchesAtlasOptions(const level_t& level, const loadoptions_t& options)
+{
+	if (!level.sheet.pixels)
+		return true;
+	if (options.compressAtlas && level.compressedSheet.empty())
+		return false;
+	if (level.textureBudget != options.textureBudget)
+		return false;
+	return options.textureBudget == 0 || options.compressAtlas == !level.compressedSheet.empty();
+}
+
+bool LoadLevel(const std::string& filepath, level_t& level, const loadoptions_t& options)
+{
+	const bool loaded = LoadLevelImpl(filepath, level, options);
+	if (!loaded)
+		UnloadLevel(level);
+
+	if (options.progress)
+	{
+		if (loaded)
+			options.progress->stage = LoadStage_t::Done;
+		else
+			options.progress->stage = options.progress->cancelled ? LoadStage_t::Cancelled : LoadStage_t::Failed;
+	}
+	return loaded;
+}
+
+static bool LoadLevelImpl(const std::string& filepath, level_t& level, const loadoptions_t& options)
+{
+	laptimer_t lap{ options.timings };
 	file_t dfx;
 	if (!ReadFile(filepath, dfx))
 		return false;
 
 	levelext_t levelData;
+	levelData.verbose = options.verbose;
 
 	const std::string vfxPath = filepath.substr(0, filepath.find_last_of(".")) + ".vfx";
-	if (level.sheet.pixels)
+	UnloadLevel(level);
+	file_t vfx;
+	const bool hasVfx = ReadFile(vfxPath, vfx);
+	lap.Lap(&loadtimings_t::readFile);
+
+	std::string cachePath;
+	uint64_t contentHash = 0;
+	if (!options.cacheDirectory.empty())
 	{
-		delete[] level.sheet.pixels;
-		level.sheet.pixels = NULL;
+		if (!EnterStage(options, LoadStage_t::Cache))
+			return false;
+		contentHash = HashLevelFiles(dfx, vfx);
+		cachePath = GetCookedLevelPath(options.cacheDirectory, contentHash);
+		bool cached = !options.keepTextures && LoadCookedLevel(cachePath, contentHash, level);
+		lap.Lap(&loadtimings_t::cache);
+		if (cached && !MatchesAtlasOptions(level, options))
+		{
+			if (options.verbose)
+				printf("Cooked level \"%s\" has an atlas for other options, cooking it again\n", cachePath.c_str());
+			UnloadLevel(level);
+			cached = false;
+		}
+		if (cached)
+		{
+			if (options.verbose)
+				printf("Loaded cooked level \"%s\"\n", cachePath.c_str());
+			return true;
+		}
 	}
-	level.list.clear();
-	if (GetTextureInformation(vfxPath, level.list))
+
+	if (!EnterStage(options, LoadStage_t::Directory))
+		return false;
+
+	levelData.dataOffset = ((dfx.Read<u32>(0) + 0x200) >> 9) << 11;
+	dfx.baseOffset = levelData.dataOffset;
+
+	levelData.modelAddress = dfx.Read<addr_t>(0x3C);
+	levelData.nObjects = dfx.Read<u32>(0x78);
+	levelData.objAddress = dfx.Read<addr_t>(0x7C);
+
+	level.textureBudget = options.textureBudget;
+	vfxdirectory_t directory;
+	if (hasVfx && ReadTextureDirectory(vfx, directory))
 	{
-		if (int size = ImagePacker::GeneratePackedList(level.list, 256); size != 0)
+		lap.Lap(&loadtimings_t::textureDirectory);
+		GetTextureInformation(directory, ScanMaterialReferences(dfx, levelData), level.list);
+		lap.Lap(&loadtimings_t::references);
+
+		// A compressed atlas is budgeted as BC3 unless no texture can have
+		// alpha, ChooseAtlasBlockFormat settles it once the texels are in
+		BlockFormat_t budgetFormat = BlockFormat_t::None;
+		if (options.compressAtlas)
+		{
+			budgetFormat = BlockFormat_t::BC1;
+			for (auto& info : level.list)
+			{
+				if (HasAlphaChannel(directory[(uintptr_t)info.userdata].tex.info.format))
+					budgetFormat = BlockFormat_t::BC3;
+			}
+		}
+		bool compact = false;
+		const ImagePacker::PackResult_t packed = PackWithinBudget(level.list, options.textureBudget, budgetFormat, compact, level.degradedTextures);
+		lap.Lap(&loadtimings_t::packing);
+		if (packed.pages != 0)
 		{
-			printf("Sheet generated at %dx%d\n", size, size);
-			level.sheet = { (unsigned int)size, (unsigned int)size, new glm::vec4[size * size] };
+			if (options.verbose)
+				printf("Sheet generated at %dx%d with %d page(s), %.1f%% filled\n", packed.width, packed.height, packed.pages, packed.GetEfficiency() * 100.0);
+			if (options.textureBudget != 0)
+			{
+				const double budgetMB = options.textureBudget / (1024.0 * 1024.0);
+				const size_t bytes = GetAtlasBytes(packed.width, packed.height, c_ATLASMIPLEVELS, packed.pages, budgetFormat, compact ? AtlasFormat_t::RGBA4444 : AtlasFormat_t::RGBA8);
+				if (bytes > options.textureBudget)
+					printf("Atlas needs %.1f MB, over the %.1f MB texture budget\n", bytes / (1024.0 * 1024.0), budgetMB);
+				else if (options.verbose && (compact || !level.degradedTextures.empty()))
+					printf("Fit the %.1f MB texture budget with %zu texture(s) downscaled%s\n", budgetMB, level.degradedTextures.size(), compact ? " at 16 bits a texel" : "");
+			}
+			BuildMaterialLookup(level);
+			level.sheet = { (unsigned int)packed.width, (unsigned int)packed.height, new rgba8_t[GetAtlasTexelCount(packed.width, packed.height, c_ATLASMIPLEVELS, packed.pages)] };
+			level.sheetLevels = c_ATLASMIPLEVELS;
+			level.sheetPages = packed.pages;
 			if (level.sheet.pixels)
 			{
-				for (int y = 0; y < size; ++y)
+				texture_t atlas = GetAtlasLevel(level.sheet, 0, level.sheetPages);
+				FillCheckerboard(atlas, GetLoadPool(options));
+				if (!EnterStage(options, LoadStage_t::Textures) || !LoadTextures(vfx, directory, level, options))
+					return false;
+				lap.Lap(&loadtimings_t::textures);
+
+				if (compact)
+					level.atlasFormat = IsOpaque(GetAtlasLevel(level.sheet, 0, level.sheetPages)) ? AtlasFormat_t::RGB565 : AtlasFormat_t::RGBA4444;
+
+				if (options.compressAtlas)
 				{
-					for (int x = 0; x < size; ++x)
-					{
-						if (((x % 128) == (x % 64) && (y % 128) == (y % 64)) || ((x % 128) != (x % 64) && (y % 128) != (y % 64)))
-							level.sheet.pixels[x + y * size] = { 1, 0, 1, 1 };
-						else
-							level.sheet.pixels[x + y * size] = { 0.5, 0, 0.5, 1 };
-					}
+					if (!EnterStage(options, LoadStage_t::Compression))
+						return false;
+					level.compressedFormat = ChooseAtlasBlockFormat(level.sheet, level.sheetPages);
+					level.compressedStorage.resize(GetCompressedAtlasSize(level.sheet.w, level.sheet.h, level.sheetLevels, level.sheetPages, level.compressedFormat));
+					CompressAtlas(level.sheet, level.sheetLevels, level.sheetPages, level.compressedFormat, level.compressedStorage.data(), GetLoadPool(options));
+					level.compressedSheet = level.compressedStorage;
+					lap.Lap(&loadtimings_t::compression);
 				}
-				LoadTextures(vfxPath, level);
 			}
 		}
 	}
 
-	levelData.dataOffset = ((dfx.Read<u32>(0) + 0x200) >> 9) << 11;
-	dfx.baseOffset = levelData.dataOffset;
-	
-	levelData.modelAddress = dfx.Read<addr_t>(0x3C);
-	levelData.nObjects = dfx.Read<u32>(0x78);
-	levelData.objAddress = dfx.Read<addr_t>(0x7C);
+	if (!EnterStage(options, LoadStage_t::Geometry))
+		return false;
 
+	dfx.baseOffset = levelData.dataOffset;
 	ReadLevelGeometry(dfx, level, levelData, dfx.Read<addr_t>(0));
 
 	std::shared_ptr<Model> cube = std::make_shared<Model>(0);
 	CreateCube(cube);
 	level.models.push_back(cube);
 
+	for (auto& m : level.models)
+		levelData.modelIndex.emplace(m->addr, m);
+	lap.Lap(&loadtimings_t::geometry);
+
+	ReadObjectModels(dfx, level, levelData, GetLoadPool(options));
+	lap.Lap(&loadtimings_t::objects);
+
+	if (!EnterStage(options, LoadStage_t::Instances))
+		return false;
+
 	for (u32 i = 0; i < levelData.nObjects; ++i)
 	{
+		if (options.progress && (i % 1024) == 0)
+		{
+			if (options.progress->cancelled)
+				return false;
+			options.progress->stageFraction = i / (float)levelData.nObjects;
+		}
 		ReadObjectInstance(dfx, level, levelData, levelData.dataOffset + levelData.objAddress + 0x30 * i);
 	}
 
@@ -848,8 +1268,29 @@ bool LoadLevel(const std::string& filepath, level_t& level)
 	dfx.baseOffset = 0;
 	std::string s;
 	s.resize(8);
-	memcpy(s.data(), dfx.data + levelData.dataOffset + 0xE0, 8);
+	memcpy(s.data(), dfx.data.data() + levelData.dataOffset + 0xE0, 8);
 	level.name = GetLevelName(s, dfx.Read<u32>(0));
+	lap.Lap(&loadtimings_t::instances);
+
+	if (!EnterStage(options, LoadStage_t::Meshes))
+		return false;
+
+	const auto meshStart = std::chrono::steady_clock::now();
+	GetLoadPool(options).ParallelFor(level.models.size(), [&level](size_t i) { BuildMesh(*level.models[i], i == 0 ? c_LEVELCHUNKTRIANGLES : 0); });
+	level.meshStats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - meshStart).count();
+	for (auto& m : level.models)
+		level.meshStats.Add(m->mesh);
+	lap.Lap(&loadtimings_t::meshes);
+	if (options.verbose)
+	{
+		const meshstats_t& stats = level.meshStats;
+		printf("Meshes built in %.2f ms: %zu corners to %zu vertices, %.2f MB instead of %.2f MB, %zu chunks\n", stats.buildMs, stats.corners, stats.vertices,
+			stats.GetBytes() / (1024.0 * 1024.0), stats.GetExpandedBytes() / (1024.0 * 1024.0), stats.chunks);
+	}
+
+	if (!cachePath.empty() && !WriteCookedLevel(cachePath, contentHash, level))
+		printf("Failed to write cooked level \"%s\"\n", cachePath.c_str());
+	lap.Lap(&loadtimings_t::cacheWrite);
 
 	return true;
 }
\ No newline at end of file
@@ -1,11 +1,18 @@
 #pragma once
+#include <atomic>
 #include <string>
 #include <vector>
 #include <memory>
+#include <span>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
+#include "blockcompress.h"
 #include "imagepacker.h"
+#include "mesh.h"
+#include "texturebudget.h"
+
+class ThreadPool;
 
 struct objinstance_t
 {
@@ -28,32 +35,138 @@ struct Model
 		size_t vertex[3];
 		unsigned int materialID;
 		unsigned short flags;
-		glm::vec2 uvs[3];
+		// Atlas page in z
+		glm::vec3 uvs[3];
 	};
 	const unsigned int addr;
 	std::string name;
 	std::vector<vertex_t> vertices;
 	std::vector<polygon_t> polygons;
 	std::vector<objinstance_t> instances;
+	mesh_t mesh;
 	bool objectVisibility = true;
 	bool showInstances = false;
 
 	Model(unsigned int addr) : addr(addr) {}
 };
 
+// One texel, bytes in R, G, B, A order to match GL_RGBA/GL_UNSIGNED_BYTE
+struct rgba8_t
+{
+	unsigned char r, g, b, a;
+};
+
 struct texture_t
 {
 	unsigned int w, h;
-	glm::vec4* pixels;
+	rgba8_t* pixels;
 };
 
 struct level_t
 {
 	std::vector<std::shared_ptr<Model>> models;
+	// Each .vfx texture on its own, only filled with loadoptions_t::keepTextures.
+	// Textures no material references have no pixels.
 	std::vector<texture_t> textures;
 	ImagePacker::ImageInformationList list;
+	// Material ID -> index into `list`, -1 for materials without a texture
+	std::vector<int> materialLookup;
+	// Holds sheetLevels mip levels of sheetPages pages, see GetAtlasLevel.
+	// w and h are the size of one page.
 	texture_t sheet{ 0, 0, NULL };
+	unsigned int sheetLevels = 0;
+	unsigned int sheetPages = 0;
+	// Block compressed copy of every sheet level and page, see CompressAtlas.
+	// Views `compressedStorage` or the cooked data, empty unless
+	// loadoptions_t::compressAtlas was set.
+	BlockFormat_t compressedFormat = BlockFormat_t::None;
+	std::span<const unsigned char> compressedSheet;
+	std::vector<unsigned char> compressedStorage;
+	// Format the sheet is uploaded in when it is not block compressed, and
+	// the textures shrunk to fit the budget it was loaded with
+	AtlasFormat_t atlasFormat = AtlasFormat_t::RGBA8;
+	std::vector<degradedtexture_t> degradedTextures;
+	size_t textureBudget = 0;
+	meshstats_t meshStats;
 	std::string name;
+
+	// Set when the level came from a cooked cache. Meshes and the sheet then
+	// view `cookedData` directly and the parsed vertices/polygons are not available.
+	bool fromCache = false;
+	std::shared_ptr<const void> cookedData;
+};
+
+enum class LoadStage_t
+{
+	Queued,
+	Cache,
+	Directory,
+	Textures,
+	Compression,
+	Geometry,
+	Instances,
+	Meshes,
+	Done,
+	Cancelled,
+	Failed
+};
+const char* GetLoadStageName(LoadStage_t stage);
+
+// Shared between a loading thread and its observer. The loader publishes the
+// stage it is in and stops at the next check once `cancelled` is set.
+struct loadprogress_t
+{
+	std::atomic<LoadStage_t> stage{ LoadStage_t::Queued };
+	// Completed fraction of the current stage, where the stage reports one
+	std::atomic<float> stageFraction{ 0.f };
+	std::atomic<bool> cancelled{ false };
+};
+
+// Wall time of each loader stage in milliseconds
+struct loadtimings_t
+{
+	double readFile = 0;          // ReadFile of the .dfx and .vfx
+	double cache = 0;             // Hashing and loading a cooked level
+	double textureDirectory = 0;  // ReadTextureDirectory
+	double references = 0;        // ScanMaterialReferences, GetTextureInformation
+	double packing = 0;           // ImagePacker::Pack
+	double textures = 0;          // LoadTextures into the atlas
+	double compression = 0;       // CompressAtlas
+	double geometry = 0;          // ReadLevelGeometry
+	double objects = 0;           // ReadObjectModels
+	double instances = 0;         // Instance table
+	double meshes = 0;            // BuildMesh for every model
+	double cacheWrite = 0;        // WriteCookedLevel
 };
 
-bool LoadLevel(const std::string& filepath, level_t& level);
\ No newline at end of file
+struct loadoptions_t
+{
+	// Print progress messages, warnings are always printed
+	bool verbose = true;
+	// Directory of cooked level caches, empty disables the cache
+	std::string cacheDirectory;
+	// Optional, see loadprogress_t
+	loadprogress_t* progress = nullptr;
+	// Optional, stage times are added to it
+	loadtimings_t* timings = nullptr;
+	// Pool the load runs its parallel stages on, ThreadPool::Get() when null
+	ThreadPool* pool = nullptr;
+	// Keep every decoded texture in level.textures as well as in the sheet.
+	// Cooked levels only hold the sheet, so this always loads from the .vfx.
+	bool keepTextures = false;
+	// Also block compress the sheet for upload, BC3 when it has any alpha and
+	// BC1 otherwise. Cooked levels without the compressed sheet are cooked again.
+	bool compressAtlas = false;
+	// GPU bytes the atlas may take with all its levels, 0 for no limit. See
+	// PackWithinBudget. Cooked levels with another budget are cooked again.
+	size_t textureBudget = 0;
+};
+
+// Returns false when the level could not be read or the load was cancelled,
+// `level` is left empty in both cases
+bool LoadLevel(const std::string& filepath, level_t& level, const loadoptions_t& options = {});
+// Frees every texture buffer and model held by the level
+void UnloadLevel(level_t& level);
+
+// Float copy of a texture in [0, 1], for debug views only
+std::vector<glm::vec4> ExpandTexture(const texture_t& texture);
\ No newline at end of file
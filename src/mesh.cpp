@@ -0,0 +1,237 @@
+#include "mesh.h"
+#include "mapreader.h"
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+static_assert(sizeof(Vertex) == 16, "Vertex must pack without padding, it is hashed and compared bytewise");
+
+uint32_t mesh_t::GetIndex(size_t i) const
+{
+	if (indexSize == sizeof(uint16_t))
+	{
+		uint16_t index;
+		memcpy(&index, indices.data() + i * sizeof(index), sizeof(index));
+		return index;
+	}
+	uint32_t index;
+	memcpy(&index, indices.data() + i * sizeof(index), sizeof(index));
+	return index;
+}
+
+void meshstats_t::Add(const mesh_t& mesh)
+{
+	corners += mesh.GetIndexCount();
+	vertices += mesh.vertices.size();
+	vertexBytes += mesh.vertices.size_bytes();
+	indexBytes += mesh.indices.size();
+	chunks += mesh.chunks.size();
+}
+
+static unsigned short QuantizeUV(float uv)
+{
+	return (unsigned short)(std::clamp(uv, 0.f, 1.f) * 65535.f + 0.5f);
+}
+
+// Position and colour of a source vertex
+static uint64_t HashSourceVertex(const Model::vertex_t& v)
+{
+	const uint64_t position = (uint64_t)(uint16_t)v.x | (uint64_t)(uint16_t)v.y << 16 | (uint64_t)(uint16_t)v.z << 32;
+	const uint64_t color = (uint64_t)v.r | (uint64_t)v.g << 8 | (uint64_t)v.b << 16 | (uint64_t)v.a << 24;
+	const uint64_t h = position * 0x9E3779B185EBCA87ull ^ std::rotl(color * 0xC2B2AE3D27D4EB4Full, 31);
+	return h ^ (h >> 29);
+}
+
+static bool SameSourceVertex(const Model::vertex_t& a, const Model::vertex_t& b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z && a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+// Cells along X and Z at most, so a chunk never gets too small to be worth
+// its own draw
+constexpr unsigned int c_MAXCHUNKGRID = 16;
+
+// Stable counting sort of the polygons into a grid over their centroids in X
+// and Z. Returns the polygon count of every cell, in the sorted order.
+static std::vector<uint32_t> SortPolygonsIntoCells(Model& model, unsigned int chunkTriangles)
+{
+	const size_t count = model.polygons.size();
+	const unsigned int n = std::clamp((unsigned int)std::ceil(std::sqrt(count / (double)chunkTriangles)), 1u, c_MAXCHUNKGRID);
+	if (n == 1)
+		return { (uint32_t)count };
+
+	// Centroids scaled by 3, which keeps them integral
+	std::vector<int> centroidX(count), centroidZ(count);
+	int minX = INT_MAX, maxX = INT_MIN, minZ = INT_MAX, maxZ = INT_MIN;
+	for (size_t p = 0; p < count; ++p)
+	{
+		const auto& polygon = model.polygons[p];
+		int x = 0, z = 0;
+		for (int i = 0; i < 3; ++i)
+		{
+			x += model.vertices[polygon.vertex[i]].x;
+			z += model.vertices[polygon.vertex[i]].z;
+		}
+		centroidX[p] = x;
+		centroidZ[p] = z;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minZ = std::min(minZ, z);
+		maxZ = std::max(maxZ, z);
+	}
+
+	auto getCell = [n](int v, int lo, int hi) { return hi == lo ? 0u : std::min(n - 1, (unsigned int)((int64_t)(v - lo) * n / (hi - lo))); };
+	std::vector<uint32_t> cells(count);
+	std::vector<uint32_t> cellCounts(n * n, 0);
+	for (size_t p = 0; p < count; ++p)
+	{
+		cells[p] = getCell(centroidZ[p], minZ, maxZ) * n + getCell(centroidX[p], minX, maxX);
+		++cellCounts[cells[p]];
+	}
+
+	std::vector<uint32_t> cellStart(n * n, 0);
+	for (size_t c = 1; c < cellCounts.size(); ++c)
+		cellStart[c] = cellStart[c - 1] + cellCounts[c - 1];
+	std::vector<Model::polygon_t> sorted(count);
+	for (size_t p = 0; p < count; ++p)
+		sorted[cellStart[cells[p]]++] = model.polygons[p];
+	model.polygons = std::move(sorted);
+	return cellCounts;
+}
+
+static void AddToBounds(meshchunk_t& chunk, const Model::vertex_t& v)
+{
+	const float position[3] = { (float)v.x, (float)v.y, (float)v.z };
+	for (int i = 0; i < 3; ++i)
+	{
+		chunk.min[i] = std::min(chunk.min[i], position[i]);
+		chunk.max[i] = std::max(chunk.max[i], position[i]);
+	}
+}
+
+// One chunk per non-empty cell, bounded by its polygons. An unsplit mesh is
+// bounded by all of the model's vertices instead.
+static void BuildChunks(Model& model, const std::vector<uint32_t>& cellCounts)
+{
+	mesh_t& mesh = model.mesh;
+	mesh.chunkStorage.clear();
+	uint32_t firstPolygon = 0;
+	for (uint32_t cellCount : cellCounts)
+	{
+		if (cellCount == 0)
+			continue;
+		meshchunk_t chunk = { firstPolygon * 3, cellCount * 3, { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+		if (cellCounts.size() == 1)
+		{
+			for (auto& v : model.vertices)
+				AddToBounds(chunk, v);
+		}
+		else
+		{
+			for (uint32_t p = firstPolygon; p < firstPolygon + cellCount; ++p)
+			{
+				for (int i = 0; i < 3; ++i)
+					AddToBounds(chunk, model.vertices[model.polygons[p].vertex[i]]);
+			}
+		}
+		mesh.chunkStorage.push_back(chunk);
+		firstPolygon += cellCount;
+	}
+}
+
+void BuildMesh(Model& model, unsigned int chunkTriangles)
+{
+	const std::vector<uint32_t> cellCounts = chunkTriangles != 0 ? SortPolygonsIntoCells(model, chunkTriangles) : std::vector<uint32_t>{ (uint32_t)model.polygons.size() };
+
+	mesh_t& mesh = model.mesh;
+	const size_t corners = model.polygons.size() * 3;
+	mesh.storage.clear();
+	mesh.storage.reserve(model.vertices.size());
+	std::vector<uint32_t> indices(corners);
+
+	// Source vertices equal in position and colour share the first one's
+	// index, found through a small open addressing table
+	const size_t sourceCount = model.vertices.size();
+	std::vector<uint32_t> shared(sourceCount);
+	{
+		const size_t mask = std::bit_ceil(std::max<size_t>(sourceCount * 2, 16)) - 1;
+		std::vector<uint32_t> slots(mask + 1, UINT32_MAX);
+		for (uint32_t i = 0; i < sourceCount; ++i)
+		{
+			size_t slot = HashSourceVertex(model.vertices[i]) & mask;
+			while (slots[slot] != UINT32_MAX && !SameSourceVertex(model.vertices[slots[slot]], model.vertices[i]))
+				slot = (slot + 1) & mask;
+			if (slots[slot] == UINT32_MAX)
+				slots[slot] = i;
+			shared[i] = slots[slot];
+		}
+	}
+
+	// Corners of one shared source vertex then only differ in UV, page and
+	// alpha. Each source gets a run of slots, one per corner using it, that
+	// holds those of the vertices emitted for it so far. Searching a run stays
+	// within a cache line or two.
+	struct emitted_t
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+	std::vector<uint32_t> runStart(sourceCount + 1, 0);
+	for (const auto& polygon : model.polygons)
+	{
+		for (int i = 0; i < 3; ++i)
+			++runStart[shared[polygon.vertex[i]] + 1];
+	}
+	for (size_t i = 0; i < sourceCount; ++i)
+		runStart[i + 1] += runStart[i];
+	std::vector<uint32_t> runLength(sourceCount, 0);
+	std::vector<emitted_t> emitted(corners);
+
+	for (size_t p = 0; p < model.polygons.size(); ++p)
+	{
+		const auto& polygon = model.polygons[p];
+		const bool hasMaterial = polygon.materialID != 0xFFFF'FFFF;
+		for (int i = 0; i < 3; ++i)
+		{
+			const uint32_t source = shared[polygon.vertex[i]];
+			const auto& v = model.vertices[source];
+			const unsigned short u = QuantizeUV(polygon.uvs[i].x), w = QuantizeUV(polygon.uvs[i].y);
+			const short page = (short)polygon.uvs[i].z;
+			const unsigned char alpha = hasMaterial ? v.a : 0;
+			const uint64_t key = u | (uint64_t)w << 16 | (uint64_t)(uint16_t)page << 32 | (uint64_t)alpha << 48;
+
+			emitted_t* run = emitted.data() + runStart[source];
+			uint32_t j = 0;
+			while (j < runLength[source] && run[j].key != key)
+				++j;
+			if (j == runLength[source])
+			{
+				run[j] = { key, (uint32_t)mesh.storage.size() };
+				++runLength[source];
+				mesh.storage.push_back({ { v.x, v.y, v.z }, page, { v.r, v.g, v.b, alpha }, { u, w } });
+			}
+			indices[p * 3 + i] = run[j].index;
+		}
+	}
+
+	mesh.indexSize = mesh.storage.size() <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+	mesh.indexStorage.resize(corners * mesh.indexSize);
+	if (mesh.indexSize == sizeof(uint16_t))
+	{
+		for (size_t i = 0; i < corners; ++i)
+		{
+			const uint16_t index = (uint16_t)indices[i];
+			memcpy(mesh.indexStorage.data() + i * sizeof(index), &index, sizeof(index));
+		}
+	}
+	else
+		memcpy(mesh.indexStorage.data(), indices.data(), corners * sizeof(uint32_t));
+
+	BuildChunks(model, cellCounts);
+	mesh.vertices = mesh.storage;
+	mesh.indices = mesh.indexStorage;
+	mesh.chunks = mesh.chunkStorage;
+}
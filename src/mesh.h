@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct Model;
+
+// Quantized GPU vertex. Positions stay in the .dfx's integer units and the
+// vertex shader applies the 1/1000 scale.
+struct Vertex
+{
+	short position[3];
+	// Atlas page of the UV, read as the position's fourth component
+	short page;
+	// Normalized, alpha 0 marks polygons without a material
+	unsigned char color[4];
+	// Normalized over the page
+	unsigned short uv[2];
+};
+
+// Bytes each triangle corner took as a float position, colour and UV before
+// meshes were indexed and quantized
+constexpr size_t c_FLOATVERTEXSIZE = sizeof(float) * (3 + 4 + 3);
+
+// A run of a mesh's triangles that is culled as a unit, with their bounds in
+// .dfx units
+struct meshchunk_t
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float min[3];
+	float max[3];
+};
+
+// Level geometry is split into chunks of about this many triangles
+constexpr unsigned int c_LEVELCHUNKTRIANGLES = 4096;
+
+// GPU-ready geometry for one model: unique vertices and three indices a
+// triangle. `vertices` and `indices` view either the storage vectors, when
+// built from the parsed polygons, or a cooked cache mapping held by the level.
+struct mesh_t
+{
+	std::span<const Vertex> vertices;
+	// 16-bit when every vertex index fits, 32-bit otherwise
+	std::span<const unsigned char> indices;
+	unsigned int indexSize = sizeof(uint16_t);
+	// Cover every index in order, one for the whole mesh unless it was split
+	std::span<const meshchunk_t> chunks;
+	std::vector<Vertex> storage;
+	std::vector<unsigned char> indexStorage;
+	std::vector<meshchunk_t> chunkStorage;
+
+	size_t GetIndexCount() const { return indices.size() / indexSize; }
+	size_t GetTriangleCount() const { return GetIndexCount() / 3; }
+	uint32_t GetIndex(size_t i) const;
+};
+
+// Mesh sizes of a level against one float vertex per triangle corner
+struct meshstats_t
+{
+	size_t corners = 0;
+	size_t vertices = 0;
+	size_t vertexBytes = 0;
+	size_t indexBytes = 0;
+	size_t chunks = 0;
+	// BuildMesh time over every model, 0 for cooked levels
+	double buildMs = 0;
+
+	void Add(const mesh_t& mesh);
+	size_t GetExpandedBytes() const { return corners * c_FLOATVERTEXSIZE; }
+	size_t GetBytes() const { return vertexBytes + indexBytes; }
+};
+
+// Quantizes every polygon corner and merges the identical ones. With
+// `chunkTriangles`, polygons are first sorted into a grid of cells over
+// their centroids in X and Z holding about that many each, and every
+// non-empty cell becomes a chunk.
+void BuildMesh(Model& model, unsigned int chunkTriangles = 0);
@@ -0,0 +1,126 @@
+#include "scenearena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+scenearena_t LayoutSceneArena(const std::vector<std::shared_ptr<Model>>& models)
+{
+	scenearena_t arena;
+	arena.ranges.resize(models.size());
+	for (size_t i = 0; i < models.size(); ++i)
+	{
+		const mesh_t& mesh = models[i]->mesh;
+		arena.ranges[i] = { (uint32_t)arena.vertexCount, (uint32_t)mesh.vertices.size(), (uint32_t)arena.indexCount, (uint32_t)mesh.GetIndexCount() };
+		arena.vertexCount += mesh.vertices.size();
+		arena.indexCount += mesh.GetIndexCount();
+		if (mesh.indexSize > arena.indexSize)
+			arena.indexSize = mesh.indexSize;
+	}
+	return arena;
+}
+
+void CopyArenaIndices(const mesh_t& mesh, size_t first, size_t count, unsigned int indexSize, unsigned char* out)
+{
+	if (mesh.indexSize == indexSize)
+	{
+		memcpy(out, mesh.indices.data() + first * indexSize, count * indexSize);
+		return;
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint32_t index = mesh.GetIndex(first + i);
+		memcpy(out + i * sizeof(index), &index, sizeof(index));
+	}
+}
+
+// World space box of `chunk` for one instance, as the vertex shader places it
+static void GetInstanceBounds(const meshchunk_t& chunk, const sceneinstance_t& instance, bool billboard, float center[3], float extent[3])
+{
+	constexpr float scale = 0.001f;
+	float localCenter[3], localExtent[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		localCenter[i] = (chunk.min[i] + chunk.max[i]) * 0.5f * scale;
+		localExtent[i] = (chunk.max[i] - chunk.min[i]) * 0.5f * scale;
+	}
+
+	if (billboard)
+	{
+		// The yaw follows the camera, so take the circle the box sweeps
+		const float x = std::abs(localCenter[0]) + localExtent[0], z = std::abs(localCenter[2]) + localExtent[2];
+		const float radius = std::sqrt(x * x + z * z);
+		center[0] = 0.f;
+		center[2] = 0.f;
+		extent[0] = extent[2] = radius;
+	}
+	else
+	{
+		const float c = std::cos(instance.yaw), s = std::sin(instance.yaw);
+		center[0] = c * localCenter[0] + s * localCenter[2];
+		center[2] = c * localCenter[2] - s * localCenter[0];
+		extent[0] = std::abs(c) * localExtent[0] + std::abs(s) * localExtent[2];
+		extent[2] = std::abs(s) * localExtent[0] + std::abs(c) * localExtent[2];
+	}
+	center[1] = localCenter[1];
+	extent[1] = localExtent[1];
+	for (int i = 0; i < 3; ++i)
+		center[i] += instance.position[i];
+}
+
+void BuildSceneCandidates(const std::vector<std::shared_ptr<Model>>& models, size_t modelCount, const std::vector<bool>& billboards,
+	scenecandidates_t& candidates)
+{
+	candidates.drawables.clear();
+	candidates.bounds.clear();
+	modelCount = std::min(modelCount, models.size());
+	for (size_t i = 0; i < modelCount; ++i)
+	{
+		const Model& model = *models[i];
+		if (!model.objectVisibility)
+			continue;
+
+		const float billboard = billboards[i] ? 1.f : 0.f;
+		for (size_t c = 0; c < model.mesh.chunks.size(); ++c)
+		{
+			for (auto& inst : model.instances)
+			{
+				if (!inst.isVisible)
+					continue;
+				const scenedrawable_t drawable = { (uint32_t)i, (uint32_t)c, { -inst.position, -inst.rotation.y, billboard } };
+				float center[3], extent[3];
+				GetInstanceBounds(model.mesh.chunks[c], drawable.instance, billboards[i], center, extent);
+				candidates.drawables.push_back(drawable);
+				candidates.bounds.push_back(center, extent);
+			}
+		}
+	}
+}
+
+scenedrawcounts_t BuildSceneDraws(const std::vector<std::shared_ptr<Model>>& models, const scenearena_t& arena, const scenecandidates_t& candidates,
+	const unsigned char* visible, std::vector<sceneinstance_t>& instances, std::vector<drawcommand_t>& commands)
+{
+	scenedrawcounts_t counts;
+	instances.clear();
+	commands.clear();
+	const scenedrawable_t* previous = nullptr;
+	for (size_t i = 0; i < candidates.drawables.size(); ++i)
+	{
+		const scenedrawable_t& drawable = candidates.drawables[i];
+		const bool level = drawable.model == 0;
+		(level ? counts.levelChunks : counts.objectInstances)++;
+		if (!visible[i])
+			continue;
+		(level ? counts.levelChunksDrawn : counts.objectInstancesDrawn)++;
+
+		if (!previous || previous->model != drawable.model || previous->chunk != drawable.chunk)
+		{
+			const meshchunk_t& chunk = models[drawable.model]->mesh.chunks[drawable.chunk];
+			const arenarange_t& range = arena.ranges[drawable.model];
+			commands.push_back({ chunk.indexCount, 0, range.firstIndex + chunk.firstIndex, (int32_t)range.baseVertex, (uint32_t)instances.size() });
+		}
+		++commands.back().instanceCount;
+		instances.push_back(drawable.instance);
+		previous = &drawable;
+	}
+	return counts;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "frustum.h"
+#include "mapreader.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Layout of GL's DrawElementsIndirectCommand
+struct drawcommand_t
+{
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+
+// Where one model's mesh lives in the arena, in vertices and indices
+struct arenarange_t
+{
+	uint32_t baseVertex = 0;
+	uint32_t vertexCount = 0;
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+};
+
+// Every model's mesh suballocated from one vertex and one index buffer, so a
+// whole scene draws from a single set of bindings. Indices stay relative to
+// their model and are offset by the draw's base vertex.
+struct scenearena_t
+{
+	std::vector<arenarange_t> ranges; // One per model
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+	// 32-bit as soon as one mesh needs it, 16-bit meshes are widened
+	unsigned int indexSize = sizeof(uint16_t);
+
+	size_t GetVertexBytes() const { return vertexCount * sizeof(Vertex); }
+	size_t GetIndexBytes() const { return indexCount * indexSize; }
+};
+
+// Per instance vertex data
+struct sceneinstance_t
+{
+	glm::vec3 position;
+	float yaw;
+	float billboard; // 1 to face the camera instead of turning by `yaw`
+};
+
+scenearena_t LayoutSceneArena(const std::vector<std::shared_ptr<Model>>& models);
+
+// Writes indices [first, first + count) of `mesh` to `out` as `indexSize`
+// byte indices
+void CopyArenaIndices(const mesh_t& mesh, size_t first, size_t count, unsigned int indexSize, unsigned char* out);
+
+// One chunk of one instance, the unit that is culled
+struct scenedrawable_t
+{
+	uint32_t model;
+	uint32_t chunk;
+	sceneinstance_t instance;
+};
+
+// Everything that can be drawn until visibility changes, ordered by model,
+// chunk then instance, with each drawable's world space box at the same index
+struct scenecandidates_t
+{
+	std::vector<scenedrawable_t> drawables;
+	cullboxes_t bounds;
+};
+
+// What one BuildSceneDraws kept. Model 0 is the level, split into chunks,
+// the others are objects with one chunk each.
+struct scenedrawcounts_t
+{
+	size_t levelChunks = 0;
+	size_t levelChunksDrawn = 0;
+	size_t objectInstances = 0;
+	size_t objectInstancesDrawn = 0;
+};
+
+// Collects a drawable for every chunk of every visible instance of the first
+// `modelCount` models. `billboards` flags models that turn to face the
+// camera, which get bounds that hold at any yaw.
+void BuildSceneCandidates(const std::vector<std::shared_ptr<Model>>& models, size_t modelCount, const std::vector<bool>& billboards,
+	scenecandidates_t& candidates);
+
+// Packs the instances of the candidates flagged in `visible` and writes one
+// command per model chunk that has any, with its instances starting at the
+// command's base instance
+scenedrawcounts_t BuildSceneDraws(const std::vector<std::shared_ptr<Model>>& models, const scenearena_t& arena, const scenecandidates_t& candidates,
+	const unsigned char* visible, std::vector<sceneinstance_t>& instances, std::vector<drawcommand_t>& commands);
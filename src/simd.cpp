@@ -0,0 +1,57 @@
+#include "simd.h"
+
+#if defined(G2_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+static Simd::Level_t DetectLevel()
+{
+#if defined(G2_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+	int regs[4];
+	__cpuid(regs, 0);
+	const int maxLeaf = regs[0];
+
+	__cpuid(regs, 1);
+	const bool sse2 = (regs[3] & (1 << 26)) != 0;
+	const bool osxsave = (regs[2] & (1 << 27)) != 0;
+	const bool avx = (regs[2] & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		__cpuidex(regs, 7, 0);
+		avx2 = (regs[1] & (1 << 5)) != 0;
+	}
+
+	if (avx2)
+		return Simd::Level_t::AVX2;
+	if (sse2)
+		return Simd::Level_t::SSE2;
+#elif defined(G2_SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return Simd::Level_t::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return Simd::Level_t::SSE2;
+#endif
+	return Simd::Level_t::Scalar;
+}
+
+Simd::Level_t Simd::GetLevel()
+{
+	static const Level_t level = DetectLevel();
+	return level;
+}
+
+const char* Simd::GetLevelName(Level_t level)
+{
+	switch (level)
+	{
+	case Level_t::AVX2:
+		return "AVX2";
+	case Level_t::SSE2:
+		return "SSE2";
+	default:
+		return "Scalar";
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define G2_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// MSVC allows any intrinsic anywhere, GCC/Clang need the function to opt in
+#if defined(_MSC_VER) && !defined(__clang__)
+#define G2_TARGET_SSE2
+#define G2_TARGET_AVX2
+#else
+#define G2_TARGET_SSE2 __attribute__((target("sse2")))
+#define G2_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Simd
+{
+	enum class Level_t
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	// Best instruction set supported by the CPU and OS, detected once
+	Level_t GetLevel();
+	const char* GetLevelName(Level_t level);
+}
@@ -0,0 +1,110 @@
+#include "texturebudget.h"
+#include "atlas.h"
+#include <algorithm>
+#include <cstdint>
+
+const char* GetAtlasFormatName(AtlasFormat_t format)
+{
+	switch (format)
+	{
+	case AtlasFormat_t::RGBA8: return "RGBA8";
+	case AtlasFormat_t::RGB565: return "RGB565";
+	case AtlasFormat_t::RGBA4444: return "RGBA4444";
+	}
+	return "";
+}
+
+size_t GetAtlasFormatBytes(AtlasFormat_t format)
+{
+	return format == AtlasFormat_t::RGBA8 ? 4 : 2;
+}
+
+size_t GetAtlasBytes(unsigned int w, unsigned int h, unsigned int levels, unsigned int pages, BlockFormat_t block, AtlasFormat_t format)
+{
+	if (block != BlockFormat_t::None)
+		return GetCompressedAtlasSize(w, h, levels, pages, block);
+	return GetAtlasTexelCount(w, h, levels, pages) * GetAtlasFormatBytes(format);
+}
+
+// Level 0 texels an image takes up with its gutter
+static size_t GetPaddedTexels(int w, int h)
+{
+	return (size_t)(w + 2 * c_ATLASGUTTER) * (h + 2 * c_ATLASGUTTER);
+}
+
+ImagePacker::PackResult_t PackWithinBudget(ImagePacker::ImageInformationList& list, size_t budget, BlockFormat_t block, bool& compact, std::vector<degradedtexture_t>& degraded)
+{
+	compact = false;
+	degraded.clear();
+	ImagePacker::PackResult_t packed = ImagePacker::Pack(list, c_ATLASGUTTER);
+	if (budget == 0 || packed.pages == 0)
+		return packed;
+
+	auto getBytes = [&](const ImagePacker::PackResult_t& p)
+		{
+			return GetAtlasBytes(p.width, p.height, c_ATLASMIPLEVELS, p.pages, block, compact ? AtlasFormat_t::RGBA4444 : AtlasFormat_t::RGBA8);
+		};
+	size_t bytes = getBytes(packed);
+	if (bytes > budget && block == BlockFormat_t::None)
+	{
+		compact = true;
+		bytes = getBytes(packed);
+	}
+	if (bytes <= budget)
+		return packed;
+
+	// Pack reorders the list, so sizes are tracked by texture index
+	auto getId = [](const ImagePacker::ImageInformation_t& info) { return (size_t)(uintptr_t)info.userdata; };
+	size_t idCount = 0;
+	for (auto& info : list)
+		idCount = std::max(idCount, getId(info) + 1);
+	std::vector<degradedtexture_t> sizes(idCount);
+	for (auto& info : list)
+		sizes[getId(info)] = { (unsigned int)getId(info), (unsigned int)info.width, (unsigned int)info.height, 0 };
+
+	std::vector<ImagePacker::ImageInformation_t*> candidates;
+	while (bytes > budget)
+	{
+		// Padded texels to give up, as if the sheet shrank in proportion to
+		// its contents. Power-of-two sheets only shrink in steps, so it may
+		// take a few rounds, which beats halving too many at once.
+		size_t padded = 0;
+		candidates.clear();
+		for (auto& info : list)
+		{
+			padded += GetPaddedTexels(info.width, info.height);
+			if (std::max(info.width, info.height) > c_BUDGETMINSIZE)
+				candidates.push_back(&info);
+		}
+		const double excess = (double)(bytes - budget) * padded / bytes;
+		if (candidates.empty())
+			break;
+		std::stable_sort(candidates.begin(), candidates.end(), [&](const auto* a, const auto* b)
+			{
+				const size_t areaA = (size_t)a->width * a->height, areaB = (size_t)b->width * b->height;
+				return areaA != areaB ? areaA > areaB : getId(*a) < getId(*b);
+			});
+
+		double freed = 0;
+		for (auto* info : candidates)
+		{
+			if (freed >= excess)
+				break;
+			const int w = std::max(1, info->width / 2), h = std::max(1, info->height / 2);
+			freed += (double)(GetPaddedTexels(info->width, info->height) - GetPaddedTexels(w, h));
+			info->width = w;
+			info->height = h;
+			++sizes[getId(*info)].droppedLevels;
+		}
+
+		packed = ImagePacker::Pack(list, c_ATLASGUTTER);
+		bytes = getBytes(packed);
+	}
+
+	for (auto& size : sizes)
+	{
+		if (size.droppedLevels != 0)
+			degraded.push_back(size);
+	}
+	return packed;
+}
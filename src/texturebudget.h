@@ -0,0 +1,39 @@
+#pragma once
+#include "blockcompress.h"
+#include "imagepacker.h"
+#include <cstddef>
+#include <vector>
+
+// Texel format the uncompressed atlas is uploaded in. The sheet stays RGBA8
+// in memory either way, the driver converts to the 16-bit formats.
+enum class AtlasFormat_t : unsigned int
+{
+	RGBA8,
+	RGB565,  // Every texel opaque
+	RGBA4444
+};
+
+const char* GetAtlasFormatName(AtlasFormat_t format);
+size_t GetAtlasFormatBytes(AtlasFormat_t format);
+// GPU size of an atlas with `levels` levels and `pages` pages, in `block`
+// when it is not BlockFormat_t::None and in `format` otherwise
+size_t GetAtlasBytes(unsigned int w, unsigned int h, unsigned int levels, unsigned int pages, BlockFormat_t block, AtlasFormat_t format);
+
+// A texture packed smaller than its large LOD to fit loadoptions_t::textureBudget
+struct degradedtexture_t
+{
+	unsigned int texture;        // Index in the .vfx
+	unsigned int width, height;  // Of the large LOD
+	unsigned int droppedLevels;  // Packed at GetMipSize(width, droppedLevels)
+	bool storedLevel = false;    // Decoded from a smaller LOD of the .vfx record, else box filtered
+};
+
+// Textures whose larger side is at most this are never shrunk
+constexpr int c_BUDGETMINSIZE = 8;
+
+// Packs `list` with the atlas gutter. With a `budget` in bytes that the atlas
+// exceeds, an uncompressed atlas first drops to 16 bits a texel (`compact`),
+// then the largest textures are halved until it fits or none is left above
+// c_BUDGETMINSIZE. `block` is the format a compressed atlas is sized in.
+// Halved textures are listed in `degraded` by texture index.
+ImagePacker::PackResult_t PackWithinBudget(ImagePacker::ImageInformationList& list, size_t budget, BlockFormat_t block, bool& compact, std::vector<degradedtexture_t>& degraded);
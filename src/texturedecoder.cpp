@@ -0,0 +1,453 @@
+#include "texturedecoder.h"
+#include <cstring>
+
+static_assert(sizeof(rgba8_t) == 4, "rgba8_t layout changed");
+
+static inline unsigned short LoadU16(const unsigned char* p)
+{
+	return (unsigned short)(p[0] | (p[1] << 8));
+}
+
+// Widens an n-bit channel to 8 bits by bit replication, so 0 and the maximum
+// map to 0 and 255 exactly
+static constexpr unsigned char Widen(unsigned int v, int bits)
+{
+	unsigned int out = 0;
+	for (int shift = 8 - bits; shift > -bits; shift -= bits)
+		out |= shift >= 0 ? v << shift : v >> -shift;
+	return (unsigned char)out;
+}
+
+template<typename Fn>
+static constexpr texeltable_t MakeTable(Fn fn)
+{
+	texeltable_t table{};
+	for (unsigned int i = 0; i < 256; ++i)
+		table[i] = fn((unsigned char)i);
+	return table;
+}
+
+// Tables for the 8-bit formats with a fixed meaning, ARGB_8332 shares RGB_332
+static constexpr texeltable_t c_RGB332 = MakeTable([](unsigned char v) { return rgba8_t{ Widen(v >> 5, 3), Widen((v >> 2) & 7, 3), Widen(v & 3, 2), 0xFF }; });
+static constexpr texeltable_t c_ALPHA8 = MakeTable([](unsigned char v) { return rgba8_t{ v, v, v, v }; });
+static constexpr texeltable_t c_INTENSITY8 = MakeTable([](unsigned char v) { return rgba8_t{ v, v, v, 0xFF }; });
+static constexpr texeltable_t c_AI44 = MakeTable([](unsigned char v) { const unsigned char i = Widen(v & 0xF, 4); return rgba8_t{ i, i, i, Widen(v >> 4, 4) }; });
+
+static_assert(c_RGB332[0xFF].r == 0xFF && c_RGB332[0xFF].g == 0xFF && c_RGB332[0xFF].b == 0xFF);
+static_assert(c_AI44[0x1F].r == 0xFF && c_AI44[0x1F].a == 0x11);
+
+void BuildYIQTable(const unsigned char yRGB[16], const short iRGB[4][3], const short qRGB[4][3], texeltable_t& table)
+{
+	auto signExtend = [](short v) { return (v & 0x100) ? (int)(short)(v | 0xFF00) : (int)v; };
+	auto clamp = [](int v) { return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v)); };
+
+	for (int in = 0; in < 256; ++in)
+	{
+		const int y = yRGB[in >> 4];
+		const short* i = iRGB[(in >> 2) & 0x3];
+		const short* q = qRGB[in & 0x3];
+		table[in] = {
+			clamp(y + signExtend(i[0]) + signExtend(q[0])),
+			clamp(y + signExtend(i[1]) + signExtend(q[1])),
+			clamp(y + signExtend(i[2]) + signExtend(q[2])),
+			0xFF
+		};
+	}
+}
+
+void BuildPaletteTable(std::span<const unsigned char> src, texeltable_t& table)
+{
+	for (size_t i = 0; i < table.size(); ++i)
+	{
+		const unsigned char* entry = src.data() + i * 4;
+		table[i] = { entry[2], entry[1], entry[0], 0xFF };
+	}
+}
+
+enum class TexelKind_t
+{
+	Indexed8,       // One byte through a table
+	AlphaIndexed16, // Alpha byte over an indexed byte
+	Packed16,       // Bit fields of one word
+	None
+};
+
+static constexpr TexelKind_t GetKind(GrTextureFormat_t format)
+{
+	switch (format)
+	{
+	case GR_TEXFMT_RGB_332:
+	case GR_TEXFMT_YIQ_422:
+	case GR_TEXFMT_ALPHA_8:
+	case GR_TEXFMT_INTENSITY_8:
+	case GR_TEXFMT_ALPHA_INTENSITY_44:
+	case GR_TEXFMT_P_8:
+		return TexelKind_t::Indexed8;
+
+	case GR_TEXFMT_ARGB_8332:
+	case GR_TEXFMT_AYIQ_8422:
+	case GR_TEXFMT_AP_88:
+		return TexelKind_t::AlphaIndexed16;
+
+	case GR_TEXFMT_RGB_565:
+	case GR_TEXFMT_ARGB_1555:
+	case GR_TEXFMT_ARGB_4444:
+	case GR_TEXFMT_ALPHA_INTENSITY_88:
+		return TexelKind_t::Packed16;
+
+	default:
+		return TexelKind_t::None;
+	}
+}
+
+bool UsesYIQTable(GrTextureFormat_t format)
+{
+	return format == GR_TEXFMT_YIQ_422 || format == GR_TEXFMT_AYIQ_8422;
+}
+
+bool UsesPalette(GrTextureFormat_t format)
+{
+	return format == GR_TEXFMT_P_8 || format == GR_TEXFMT_AP_88;
+}
+
+bool HasAlphaChannel(GrTextureFormat_t format)
+{
+	switch (format)
+	{
+	case GR_TEXFMT_ALPHA_8:
+	case GR_TEXFMT_ALPHA_INTENSITY_44:
+	case GR_TEXFMT_ARGB_8332:
+	case GR_TEXFMT_AYIQ_8422:
+	case GR_TEXFMT_ARGB_1555:
+	case GR_TEXFMT_ARGB_4444:
+	case GR_TEXFMT_ALPHA_INTENSITY_88:
+	case GR_TEXFMT_AP_88:
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t GetTexelSize(GrTextureFormat_t format)
+{
+	switch (GetKind(format))
+	{
+	case TexelKind_t::Indexed8:
+		return 1;
+	case TexelKind_t::AlphaIndexed16:
+	case TexelKind_t::Packed16:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+template<GrTextureFormat_t Format>
+static const texeltable_t& GetTable(const texturetables_t& tables)
+{
+	if constexpr (Format == GR_TEXFMT_RGB_332 || Format == GR_TEXFMT_ARGB_8332)
+		return c_RGB332;
+	else if constexpr (Format == GR_TEXFMT_ALPHA_8)
+		return c_ALPHA8;
+	else if constexpr (Format == GR_TEXFMT_INTENSITY_8)
+		return c_INTENSITY8;
+	else if constexpr (Format == GR_TEXFMT_ALPHA_INTENSITY_44)
+		return c_AI44;
+	else if constexpr (Format == GR_TEXFMT_YIQ_422 || Format == GR_TEXFMT_AYIQ_8422)
+		return tables.yiq;
+	else
+		return tables.palette;
+}
+
+// ARGB1555 keeps the original x8 widening so existing textures decode unchanged
+template<GrTextureFormat_t Format>
+static inline rgba8_t DecodePacked(unsigned short p)
+{
+	if constexpr (Format == GR_TEXFMT_ARGB_4444)
+		return { (unsigned char)(((p >> 8) & 0xF) * 0x11), (unsigned char)(((p >> 4) & 0xF) * 0x11), (unsigned char)((p & 0xF) * 0x11), (unsigned char)((p >> 12) * 0x11) };
+	else if constexpr (Format == GR_TEXFMT_ARGB_1555)
+		return { (unsigned char)(((p >> 10) & 0x1F) * 0x08), (unsigned char)(((p >> 5) & 0x1F) * 0x08), (unsigned char)((p & 0x1F) * 0x08), (unsigned char)((p & 0x8000) ? 0xFF : 0x00) };
+	else if constexpr (Format == GR_TEXFMT_RGB_565)
+		return { Widen(p >> 11, 5), Widen((p >> 5) & 0x3F, 6), Widen(p & 0x1F, 5), 0xFF };
+	else
+		return { (unsigned char)p, (unsigned char)p, (unsigned char)p, (unsigned char)(p >> 8) };
+}
+
+template<GrTextureFormat_t Format>
+static void DecodeScalar(const unsigned char* src, size_t count, const texeltable_t& table, rgba8_t* out)
+{
+	constexpr TexelKind_t kind = GetKind(Format);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if constexpr (kind == TexelKind_t::Indexed8)
+			out[i] = table[src[i]];
+		else if constexpr (kind == TexelKind_t::AlphaIndexed16)
+		{
+			out[i] = table[src[i * 2]];
+			out[i].a = src[i * 2 + 1];
+		}
+		else
+			out[i] = DecodePacked<Format>(LoadU16(src + i * 2));
+	}
+}
+
+#ifdef G2_SIMD_X86
+// Each expansion turns 8 (SSE2) or 16 (AVX2) texel words into RGBA bytes,
+// `lo` and `hi` being the unpacked low and high halves of each 128-bit lane
+
+// A R G B nibbles, high to low
+G2_TARGET_SSE2
+static inline void ExpandARGB4444(__m128i v, __m128i& lo, __m128i& hi)
+{
+	const __m128i nibbles = _mm_set1_epi16(0x0F0F);
+	__m128i br = _mm_and_si128(v, nibbles);                    // bytes B, R
+	__m128i ga = _mm_and_si128(_mm_srli_epi16(v, 4), nibbles); // bytes G, A
+	br = _mm_or_si128(br, _mm_slli_epi16(br, 4));
+	ga = _mm_or_si128(ga, _mm_slli_epi16(ga, 4));
+	const __m128i rb = _mm_or_si128(_mm_srli_epi16(br, 8), _mm_slli_epi16(br, 8));
+	lo = _mm_unpacklo_epi8(rb, ga);
+	hi = _mm_unpackhi_epi8(rb, ga);
+}
+
+// A(1) R(5) G(5) B(5), high to low
+G2_TARGET_SSE2
+static inline void ExpandARGB1555(__m128i v, __m128i& lo, __m128i& hi)
+{
+	const __m128i top5 = _mm_set1_epi16(0xF8);
+	const __m128i r = _mm_and_si128(_mm_srli_epi16(v, 7), top5);
+	const __m128i g = _mm_and_si128(_mm_srli_epi16(v, 2), top5);
+	const __m128i b = _mm_and_si128(_mm_slli_epi16(v, 3), top5);
+	const __m128i a = _mm_srai_epi16(v, 15);
+	const __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+	const __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+	lo = _mm_unpacklo_epi16(rg, ba);
+	hi = _mm_unpackhi_epi16(rg, ba);
+}
+
+// R(5) G(6) B(5), high to low
+G2_TARGET_SSE2
+static inline void ExpandRGB565(__m128i v, __m128i& lo, __m128i& hi)
+{
+	const __m128i r = _mm_srli_epi16(v, 11);
+	const __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), _mm_set1_epi16(0x3F));
+	const __m128i b = _mm_and_si128(v, _mm_set1_epi16(0x1F));
+	const __m128i r8 = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+	const __m128i g8 = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+	const __m128i b8 = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+	const __m128i rg = _mm_or_si128(r8, _mm_slli_epi16(g8, 8));
+	const __m128i ba = _mm_or_si128(b8, _mm_set1_epi16((short)0xFF00));
+	lo = _mm_unpacklo_epi16(rg, ba);
+	hi = _mm_unpackhi_epi16(rg, ba);
+}
+
+// Alpha byte over intensity byte
+G2_TARGET_SSE2
+static inline void ExpandAI88(__m128i v, __m128i& lo, __m128i& hi)
+{
+	const __m128i i = _mm_and_si128(v, _mm_set1_epi16(0xFF));
+	const __m128i ii = _mm_or_si128(i, _mm_slli_epi16(i, 8));
+	lo = _mm_unpacklo_epi16(ii, v);
+	hi = _mm_unpackhi_epi16(ii, v);
+}
+
+G2_TARGET_AVX2
+static inline void ExpandARGB4444(__m256i v, __m256i& lo, __m256i& hi)
+{
+	const __m256i nibbles = _mm256_set1_epi16(0x0F0F);
+	__m256i br = _mm256_and_si256(v, nibbles);
+	__m256i ga = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibbles);
+	br = _mm256_or_si256(br, _mm256_slli_epi16(br, 4));
+	ga = _mm256_or_si256(ga, _mm256_slli_epi16(ga, 4));
+	const __m256i rb = _mm256_or_si256(_mm256_srli_epi16(br, 8), _mm256_slli_epi16(br, 8));
+	lo = _mm256_unpacklo_epi8(rb, ga);
+	hi = _mm256_unpackhi_epi8(rb, ga);
+}
+
+G2_TARGET_AVX2
+static inline void ExpandARGB1555(__m256i v, __m256i& lo, __m256i& hi)
+{
+	const __m256i top5 = _mm256_set1_epi16(0xF8);
+	const __m256i r = _mm256_and_si256(_mm256_srli_epi16(v, 7), top5);
+	const __m256i g = _mm256_and_si256(_mm256_srli_epi16(v, 2), top5);
+	const __m256i b = _mm256_and_si256(_mm256_slli_epi16(v, 3), top5);
+	const __m256i a = _mm256_srai_epi16(v, 15);
+	const __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+	const __m256i ba = _mm256_or_si256(b, _mm256_slli_epi16(a, 8));
+	lo = _mm256_unpacklo_epi16(rg, ba);
+	hi = _mm256_unpackhi_epi16(rg, ba);
+}
+
+G2_TARGET_AVX2
+static inline void ExpandRGB565(__m256i v, __m256i& lo, __m256i& hi)
+{
+	const __m256i r = _mm256_srli_epi16(v, 11);
+	const __m256i g = _mm256_and_si256(_mm256_srli_epi16(v, 5), _mm256_set1_epi16(0x3F));
+	const __m256i b = _mm256_and_si256(v, _mm256_set1_epi16(0x1F));
+	const __m256i r8 = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+	const __m256i g8 = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+	const __m256i b8 = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+	const __m256i rg = _mm256_or_si256(r8, _mm256_slli_epi16(g8, 8));
+	const __m256i ba = _mm256_or_si256(b8, _mm256_set1_epi16((short)0xFF00));
+	lo = _mm256_unpacklo_epi16(rg, ba);
+	hi = _mm256_unpackhi_epi16(rg, ba);
+}
+
+G2_TARGET_AVX2
+static inline void ExpandAI88(__m256i v, __m256i& lo, __m256i& hi)
+{
+	const __m256i i = _mm256_and_si256(v, _mm256_set1_epi16(0xFF));
+	const __m256i ii = _mm256_or_si256(i, _mm256_slli_epi16(i, 8));
+	lo = _mm256_unpacklo_epi16(ii, v);
+	hi = _mm256_unpackhi_epi16(ii, v);
+}
+
+template<GrTextureFormat_t Format>
+G2_TARGET_SSE2
+static inline void ExpandPacked(__m128i v, __m128i& lo, __m128i& hi)
+{
+	if constexpr (Format == GR_TEXFMT_ARGB_4444)
+		ExpandARGB4444(v, lo, hi);
+	else if constexpr (Format == GR_TEXFMT_ARGB_1555)
+		ExpandARGB1555(v, lo, hi);
+	else if constexpr (Format == GR_TEXFMT_RGB_565)
+		ExpandRGB565(v, lo, hi);
+	else
+		ExpandAI88(v, lo, hi);
+}
+
+template<GrTextureFormat_t Format>
+G2_TARGET_AVX2
+static inline void ExpandPacked(__m256i v, __m256i& lo, __m256i& hi)
+{
+	if constexpr (Format == GR_TEXFMT_ARGB_4444)
+		ExpandARGB4444(v, lo, hi);
+	else if constexpr (Format == GR_TEXFMT_ARGB_1555)
+		ExpandARGB1555(v, lo, hi);
+	else if constexpr (Format == GR_TEXFMT_RGB_565)
+		ExpandRGB565(v, lo, hi);
+	else
+		ExpandAI88(v, lo, hi);
+}
+
+template<GrTextureFormat_t Format>
+G2_TARGET_SSE2
+static size_t DecodePackedSSE2(const unsigned char* src, size_t count, rgba8_t* out)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i lo, hi;
+		ExpandPacked<Format>(_mm_loadu_si128((const __m128i*)(src + i * 2)), lo, hi);
+		_mm_storeu_si128((__m128i*)(out + i), lo);
+		_mm_storeu_si128((__m128i*)(out + i + 4), hi);
+	}
+	return i;
+}
+
+template<GrTextureFormat_t Format>
+G2_TARGET_AVX2
+static size_t DecodePackedAVX2(const unsigned char* src, size_t count, rgba8_t* out)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i lo, hi;
+		ExpandPacked<Format>(_mm256_loadu_si256((const __m256i*)(src + i * 2)), lo, hi);
+		// lo holds texels 0-3 and 8-11
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(out + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	return i;
+}
+
+G2_TARGET_AVX2
+static size_t DecodeIndexed8AVX2(const unsigned char* src, size_t count, const texeltable_t& table, rgba8_t* out)
+{
+	const int* lut = (const int*)table.data();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_i32gather_epi32(lut, index, 4));
+	}
+	return i;
+}
+
+G2_TARGET_AVX2
+static size_t DecodeAlphaIndexed16AVX2(const unsigned char* src, size_t count, const texeltable_t& table, rgba8_t* out)
+{
+	const int* lut = (const int*)table.data();
+	const __m256i indexMask = _mm256_set1_epi32(0xFF);
+	const __m256i colorMask = _mm256_set1_epi32(0x00FFFFFF);
+	const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i * 2)));
+		const __m256i color = _mm256_and_si256(_mm256_i32gather_epi32(lut, _mm256_and_si256(words, indexMask), 4), colorMask);
+		const __m256i alpha = _mm256_and_si256(_mm256_slli_epi32(words, 16), alphaMask);
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_or_si256(color, alpha));
+	}
+	return i;
+}
+#endif
+
+template<GrTextureFormat_t Format>
+void DecodeTexels(std::span<const unsigned char> src, size_t count, const texturetables_t& tables, rgba8_t* out, Simd::Level_t level)
+{
+	constexpr TexelKind_t kind = GetKind(Format);
+	static_assert(kind != TexelKind_t::None, "format has no decoder");
+	constexpr size_t texelSize = kind == TexelKind_t::Indexed8 ? 1 : 2;
+	const texeltable_t& table = GetTable<Format>(tables);
+
+	size_t done = 0;
+#ifdef G2_SIMD_X86
+	// SSE2 has no gather, the table formats use the scalar lookups there
+	if constexpr (kind == TexelKind_t::Packed16)
+	{
+		if (level == Simd::Level_t::AVX2)
+			done = DecodePackedAVX2<Format>(src.data(), count, out);
+		if (level != Simd::Level_t::Scalar)
+			done += DecodePackedSSE2<Format>(src.data() + done * 2, count - done, out + done);
+	}
+	else if (level == Simd::Level_t::AVX2)
+	{
+		if constexpr (kind == TexelKind_t::Indexed8)
+			done = DecodeIndexed8AVX2(src.data(), count, table, out);
+		else
+			done = DecodeAlphaIndexed16AVX2(src.data(), count, table, out);
+	}
+#endif
+	DecodeScalar<Format>(src.data() + done * texelSize, count - done, table, out + done);
+}
+
+#define G2_TEXTURE_FORMATS(X) \
+	X(GR_TEXFMT_RGB_332) \
+	X(GR_TEXFMT_YIQ_422) \
+	X(GR_TEXFMT_ALPHA_8) \
+	X(GR_TEXFMT_INTENSITY_8) \
+	X(GR_TEXFMT_ALPHA_INTENSITY_44) \
+	X(GR_TEXFMT_P_8) \
+	X(GR_TEXFMT_ARGB_8332) \
+	X(GR_TEXFMT_AYIQ_8422) \
+	X(GR_TEXFMT_RGB_565) \
+	X(GR_TEXFMT_ARGB_1555) \
+	X(GR_TEXFMT_ARGB_4444) \
+	X(GR_TEXFMT_ALPHA_INTENSITY_88) \
+	X(GR_TEXFMT_AP_88)
+
+#define G2_INSTANTIATE(format) template void DecodeTexels<format>(std::span<const unsigned char>, size_t, const texturetables_t&, rgba8_t*, Simd::Level_t);
+G2_TEXTURE_FORMATS(G2_INSTANTIATE)
+#undef G2_INSTANTIATE
+
+bool DecodeTexels(GrTextureFormat_t format, std::span<const unsigned char> src, size_t count, const texturetables_t& tables, rgba8_t* out, Simd::Level_t level)
+{
+	switch (format)
+	{
+#define G2_DISPATCH(format) case format: DecodeTexels<format>(src, count, tables, out, level); return true;
+		G2_TEXTURE_FORMATS(G2_DISPATCH)
+#undef G2_DISPATCH
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "glideconstants.h"
+#include "mapreader.h"
+#include "simd.h"
+#include <array>
+#include <span>
+
+// The texel for every possible 8-bit index
+using texeltable_t = std::array<rgba8_t, 256>;
+
+// Per-texture lookup tables, only the ones the format uses need to be built.
+// `yiq` serves YIQ_422 and AYIQ_8422, `palette` serves P_8 and AP_88.
+struct texturetables_t
+{
+	texeltable_t yiq;
+	texeltable_t palette;
+};
+
+// P_8 and AP_88 textures start with 256 little-endian 0x00RRGGBB palette words
+constexpr size_t c_PALETTEBYTES = 256 * 4;
+
+// Expands a texture's NCC table. I and Q entries are 9-bit signed values as
+// stored in the .vfx.
+void BuildYIQTable(const unsigned char yRGB[16], const short iRGB[4][3], const short qRGB[4][3], texeltable_t& table);
+// Palette entries are opaque, AP_88 takes alpha from the texel instead
+void BuildPaletteTable(std::span<const unsigned char> src, texeltable_t& table);
+
+bool UsesYIQTable(GrTextureFormat_t format);
+bool UsesPalette(GrTextureFormat_t format);
+// Whether texels of the format can be anything but opaque
+bool HasAlphaChannel(GrTextureFormat_t format);
+// Bytes per texel, 0 for formats without a decoder
+size_t GetTexelSize(GrTextureFormat_t format);
+
+// Decodes `count` texels from `src`, which must hold at least that many, into
+// `out`. The SIMD paths produce output bit-identical to Simd::Level_t::Scalar.
+template<GrTextureFormat_t Format>
+void DecodeTexels(std::span<const unsigned char> src, size_t count, const texturetables_t& tables, rgba8_t* out, Simd::Level_t level = Simd::GetLevel());
+
+// Runtime dispatch to DecodeTexels<Format>, false for formats without a decoder
+bool DecodeTexels(GrTextureFormat_t format, std::span<const unsigned char> src, size_t count, const texturetables_t& tables, rgba8_t* out, Simd::Level_t level = Simd::GetLevel());
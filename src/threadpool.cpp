@@ -0,0 +1,105 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+
+struct ThreadPool::job_t
+{
+	const std::function<void(size_t)>* fn;
+	size_t count;
+	std::atomic<size_t> next{ 0 };
+	std::atomic<size_t> done{ 0 };
+};
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == c_CALLERONLY)
+		threadCount = 0;
+	else if (threadCount == 0)
+	{
+		unsigned int hw = std::thread::hardware_concurrency();
+		threadCount = hw > 1 ? hw - 1 : 0;
+	}
+
+	threads.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; ++i)
+		threads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void ThreadPool::RunJob(job_t& job)
+{
+	for (size_t i = job.next++; i < job.count; i = job.next++)
+	{
+		(*job.fn)(i);
+		++job.done;
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	std::unique_lock lock(mutex);
+	while (true)
+	{
+		wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+		if (stopping)
+			return;
+
+		std::shared_ptr<job_t> job = jobs.front();
+		// Fully handed out jobs leave the queue, their owner waits for the rest
+		if (job->next >= job->count)
+		{
+			jobs.pop_front();
+			continue;
+		}
+
+		lock.unlock();
+		RunJob(*job);
+		lock.lock();
+		finished.notify_all();
+	}
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+	if (count == 0)
+		return;
+
+	if (count == 1 || threads.empty())
+	{
+		for (size_t i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	auto job = std::make_shared<job_t>();
+	job->fn = &fn;
+	job->count = count;
+	{
+		std::lock_guard lock(mutex);
+		jobs.push_back(job);
+	}
+	wake.notify_all();
+
+	RunJob(*job);
+
+	std::unique_lock lock(mutex);
+	finished.wait(lock, [&job] { return job->done == job->count; });
+	if (auto it = std::find(jobs.begin(), jobs.end(), job); it != jobs.end())
+		jobs.erase(it);
+}
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return pool;
+}
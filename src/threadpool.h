@@ -0,0 +1,46 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// For a pool without workers that runs everything on the caller
+	static constexpr unsigned int c_CALLERONLY = ~0u;
+
+	// 0 threads picks one per hardware thread, minus the caller
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Workers plus the calling thread
+	unsigned int GetConcurrency() const { return (unsigned int)threads.size() + 1; }
+
+	// Runs fn(i) for every i in [0, count) and returns once all calls finished.
+	// The calling thread takes part, so nested and concurrent calls always
+	// make progress even when every worker is busy.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+	// Process-wide pool shared by the loader and tools
+	static ThreadPool& Get();
+
+private:
+	struct job_t;
+
+	void WorkerLoop();
+	static void RunJob(job_t& job);
+
+	std::vector<std::thread> threads;
+	std::deque<std::shared_ptr<job_t>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	bool stopping = false;
+};
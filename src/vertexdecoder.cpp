@@ -0,0 +1,143 @@
+#include "vertexdecoder.h"
+#include <cstddef>
+#include <cstring>
+
+// The SIMD paths write vertex_t as raw bytes, so its layout is load-bearing
+static_assert(sizeof(Model::vertex_t) == 18, "vertex_t layout changed");
+static_assert(offsetof(Model::vertex_t, oX) == 6, "vertex_t layout changed");
+static_assert(offsetof(Model::vertex_t, normalId) == 12, "vertex_t layout changed");
+static_assert(offsetof(Model::vertex_t, r) == 14, "vertex_t layout changed");
+
+// Record layout: i16 x, i16 y, i16 z, u16 normal, u8 r, g, b, a
+// Output layout: x, z, -y, x, z, -y, normal, r, g, b, a
+
+static inline short LoadI16(const unsigned char* p)
+{
+	return (short)(p[0] | (p[1] << 8));
+}
+
+static void DecodeVerticesScalar(const unsigned char* src, size_t count, bool isLevel, Model::vertex_t* out)
+{
+	for (size_t i = 0; i < count; ++i, src += c_VERTEXRECORDSIZE)
+	{
+		const short x = LoadI16(src + 0);
+		const short y = LoadI16(src + 4);
+		const short z = (short)-LoadI16(src + 2);
+		out[i] = {
+			x, y, z,
+			x, y, z,
+			(unsigned short)LoadI16(src + 6),
+			src[8], src[9], src[10], src[11]
+		};
+
+		if (!isLevel)
+		{
+			out[i].r = 128;
+			out[i].g = 128;
+			out[i].b = 128;
+			out[i].a = 255;
+		}
+	}
+}
+
+#ifdef G2_SIMD_X86
+// Flat grey object colour as the two trailing 16-bit words: (r, g), (b, a)
+constexpr short c_OBJECTRG = (short)0x8080;
+constexpr short c_OBJECTBA = (short)0xFF80;
+
+G2_TARGET_SSE2
+static void DecodeVerticesSSE2(const unsigned char* src, size_t count, bool isLevel, Model::vertex_t* out)
+{
+	// Lanes 2 and 5 hold the negated Z: (v ^ -1) - -1 == -v
+	const __m128i negate = _mm_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0);
+	unsigned char* dst = (unsigned char*)out;
+
+	for (size_t i = 0; i < count; ++i, src += c_VERTEXRECORDSIZE, dst += sizeof(Model::vertex_t))
+	{
+		// Words: x y z n rg ba (+2 words of the next record)
+		const __m128i v = _mm_loadu_si128((const __m128i*)src);
+		const __m128i lo = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 0));                    // x z y x
+		const __m128i hi = _mm_shufflelo_epi16(_mm_srli_si128(v, 2), _MM_SHUFFLE(3, 2, 0, 1)); // z y n rg
+		__m128i r = _mm_unpacklo_epi64(lo, hi);
+		r = _mm_sub_epi16(_mm_xor_si128(r, negate), negate);
+
+		if (isLevel)
+		{
+			_mm_storeu_si128((__m128i*)dst, r);
+			memcpy(dst + 16, src + 10, 2);
+		}
+		else
+		{
+			_mm_storeu_si128((__m128i*)dst, _mm_insert_epi16(r, c_OBJECTRG, 7));
+			memcpy(dst + 16, &c_OBJECTBA, 2);
+		}
+	}
+}
+
+G2_TARGET_AVX2
+static void DecodeVerticesAVX2(const unsigned char* src, size_t count, bool isLevel, Model::vertex_t* out)
+{
+	// One record per 128-bit lane, shuffled into x z y x z y n rg in a single pass
+	const __m256i shuffle = _mm256_setr_epi8(
+		0, 1, 4, 5, 2, 3, 0, 1, 4, 5, 2, 3, 6, 7, 8, 9,
+		0, 1, 4, 5, 2, 3, 0, 1, 4, 5, 2, 3, 6, 7, 8, 9);
+	const __m256i negate = _mm256_setr_epi16(
+		0, 0, -1, 0, 0, -1, 0, 0,
+		0, 0, -1, 0, 0, -1, 0, 0);
+	const __m256i grey = _mm256_set1_epi16(c_OBJECTRG);
+	unsigned char* dst = (unsigned char*)out;
+
+	constexpr size_t c_STEP = 4;
+	size_t i = 0;
+	for (; i + c_STEP <= count; i += c_STEP, src += c_STEP * c_VERTEXRECORDSIZE, dst += c_STEP * sizeof(Model::vertex_t))
+	{
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + 0))), _mm_loadu_si128((const __m128i*)(src + 12)), 1);
+		__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + 24))), _mm_loadu_si128((const __m128i*)(src + 36)), 1);
+		a = _mm256_shuffle_epi8(a, shuffle);
+		b = _mm256_shuffle_epi8(b, shuffle);
+		a = _mm256_sub_epi16(_mm256_xor_si256(a, negate), negate);
+		b = _mm256_sub_epi16(_mm256_xor_si256(b, negate), negate);
+		if (!isLevel)
+		{
+			a = _mm256_blend_epi16(a, grey, 0x80);
+			b = _mm256_blend_epi16(b, grey, 0x80);
+		}
+
+		_mm_storeu_si128((__m128i*)(dst + 0), _mm256_castsi256_si128(a));
+		_mm_storeu_si128((__m128i*)(dst + 18), _mm256_extracti128_si256(a, 1));
+		_mm_storeu_si128((__m128i*)(dst + 36), _mm256_castsi256_si128(b));
+		_mm_storeu_si128((__m128i*)(dst + 54), _mm256_extracti128_si256(b, 1));
+
+		for (size_t j = 0; j < c_STEP; ++j)
+		{
+			if (isLevel)
+				memcpy(dst + j * sizeof(Model::vertex_t) + 16, src + j * c_VERTEXRECORDSIZE + 10, 2);
+			else
+				memcpy(dst + j * sizeof(Model::vertex_t) + 16, &c_OBJECTBA, 2);
+		}
+	}
+
+	DecodeVerticesSSE2(src, count - i, isLevel, (Model::vertex_t*)dst);
+}
+#endif
+
+void DecodeVertices(std::span<const unsigned char> src, size_t count, bool isLevel, Model::vertex_t* out, Simd::Level_t level)
+{
+	size_t vectorCount = 0;
+#ifdef G2_SIMD_X86
+	// Vector loads read 16 bytes per 12-byte record, so the final records that
+	// would read past the end of `src` are left to the scalar path.
+	if (level != Simd::Level_t::Scalar && src.size() >= 16)
+	{
+		vectorCount = (src.size() - 16) / c_VERTEXRECORDSIZE + 1;
+		if (vectorCount > count)
+			vectorCount = count;
+
+		if (level == Simd::Level_t::AVX2)
+			DecodeVerticesAVX2(src.data(), vectorCount, isLevel, out);
+		else
+			DecodeVerticesSSE2(src.data(), vectorCount, isLevel, out);
+	}
+#endif
+	DecodeVerticesScalar(src.data() + vectorCount * c_VERTEXRECORDSIZE, count - vectorCount, isLevel, out + vectorCount);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "mapreader.h"
+#include "simd.h"
+#include <span>
+
+// Size of one record in a .dfx vertex table
+constexpr size_t c_VERTEXRECORDSIZE = 12;
+
+// Decodes `count` vertex records from `src` into `out` in one pass.
+// Y and Z are swapped and Z negated to match the viewer's axes. Level vertices
+// keep their baked colours, object vertices are set to flat grey.
+// The SIMD paths produce output bit-identical to Simd::Level_t::Scalar.
+void DecodeVertices(std::span<const unsigned char> src, size_t count, bool isLevel, Model::vertex_t* out, Simd::Level_t level = Simd::GetLevel());
@@ -0,0 +1,1299 @@
+#include "atlas.h"
+#include "blockcompress.h"
+#include "imagepacker.h"
+#include "mapreader.h"
+#include "scenearena.h"
+#include "synthlevel.h"
+#include "texturedecoder.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+static double MillisecondsSince(clock_type::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+// Resolves a 100k entry instance table against an increasing number of model
+// types. With the model index the time per instance should stay flat.
+static bool BenchInstances(const std::filesystem::path& dir)
+{
+	constexpr unsigned int c_INSTANCES = 100'000;
+	const unsigned int modelCounts[] = { 1, 16, 256, 1024, 4096 };
+
+	printf("%-10s %-10s %12s %14s\n", "models", "instances", "load (ms)", "ns/instance");
+	for (unsigned int models : modelCounts)
+	{
+		const std::string path = (dir / ("instances_" + std::to_string(models) + ".dfx")).string();
+		if (!WriteSyntheticLevel(path, { models, c_INSTANCES }))
+		{
+			printf("Failed to write %s\n", path.c_str());
+			return false;
+		}
+
+		loadoptions_t options;
+		options.verbose = false;
+		level_t level;
+		auto start = clock_type::now();
+		bool ok = LoadLevel(path, level, options);
+		double ms = MillisecondsSince(start);
+		std::filesystem::remove(path);
+		if (!ok)
+		{
+			printf("Failed to load %s\n", path.c_str());
+			return false;
+		}
+
+		size_t placed = 0;
+		for (auto& m : level.models)
+			placed += m->instances.size();
+		// The level itself carries one instance
+		if (placed != c_INSTANCES + 1)
+		{
+			printf("Expected %u instances, got %zu\n", c_INSTANCES, placed - 1);
+			return false;
+		}
+
+		printf("%-10u %-10u %12.2f %14.1f\n", models, c_INSTANCES, ms, ms * 1e6 / c_INSTANCES);
+	}
+
+	return true;
+}
+
+// Loads a level once to cook it and then again from the cooked cache.
+// Without an argument a synthetic level with 200k polygons is used.
+static bool BenchCache(const std::filesystem::path& dir, const char* levelPath)
+{
+	constexpr int c_WARMRUNS = 5;
+
+	std::string path;
+	if (levelPath)
+		path = levelPath;
+	else
+	{
+		path = (dir / "cache_synth.dfx").string();
+		synthleveloptions_t options;
+		options.modelCount = 64;
+		options.instanceCount = 10'000;
+		options.levelVertexCount = 60'000;
+		options.levelPolygonCount = 200'000;
+		if (!WriteSyntheticLevel(path, options))
+		{
+			printf("Failed to write %s\n", path.c_str());
+			return false;
+		}
+	}
+
+	const std::filesystem::path cacheDir = dir / "g2bench_cache";
+	std::filesystem::remove_all(cacheDir);
+
+	loadoptions_t options;
+	options.verbose = false;
+	options.cacheDirectory = cacheDir.string();
+
+	bool ok = true;
+	size_t coldTriangles = 0;
+	double coldMs = 0, warmMs = 0;
+	{
+		level_t level;
+		auto start = clock_type::now();
+		ok = LoadLevel(path, level, options) && !level.fromCache;
+		coldMs = MillisecondsSince(start);
+		for (auto& m : level.models)
+			coldTriangles += m->mesh.GetTriangleCount();
+		UnloadLevel(level);
+	}
+
+	for (int i = 0; ok && i < c_WARMRUNS; ++i)
+	{
+		level_t level;
+		auto start = clock_type::now();
+		ok = LoadLevel(path, level, options) && level.fromCache;
+		warmMs += MillisecondsSince(start);
+
+		size_t triangles = 0;
+		for (auto& m : level.models)
+			triangles += m->mesh.GetTriangleCount();
+		ok = ok && triangles == coldTriangles;
+		UnloadLevel(level);
+	}
+
+	if (!levelPath)
+		std::filesystem::remove(path);
+	std::filesystem::remove_all(cacheDir);
+
+	if (!ok)
+	{
+		printf("Cache round trip failed for %s\n", path.c_str());
+		return false;
+	}
+
+	warmMs /= c_WARMRUNS;
+	printf("%-10s %12s %12s\n", "triangles", "cold (ms)", "warm (ms)");
+	printf("%-10zu %12.2f %12.2f  (%.1fx)\n", coldTriangles, coldMs, warmMs, coldMs / warmMs);
+	return true;
+}
+
+// Level used by the stage bench and written by `g2bench generate`
+static synthleveloptions_t GetStageLevelOptions()
+{
+	synthleveloptions_t options;
+	options.modelCount = 128;
+	options.instanceCount = 20'000;
+	options.levelVertexCount = 30'000;
+	options.levelPolygonCount = 100'000;
+	options.objectVertexCount = 200;
+	options.objectPolygonCount = 300;
+	options.materialCount = 512;
+	options.textureCount = 256;
+	return options;
+}
+
+struct stage_t
+{
+	stage_t(const char* name, double loadtimings_t::* time, const char* unit) : name(name), time(time), unit(unit) {}
+
+	const char* name;
+	double loadtimings_t::* time;
+	const char* unit;
+	double amount = 0; // Units processed per load
+	std::vector<double> samples;
+};
+
+static double Median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	return values.empty() ? 0 : values[values.size() / 2];
+}
+
+// Baseline files hold one "<stage> <throughput>" line per stage
+static std::map<std::string, double> ReadBaseline(const std::string& path)
+{
+	std::map<std::string, double> baseline;
+	std::ifstream file(path);
+	std::string name;
+	double value;
+	while (file >> name >> value)
+		baseline[name] = value;
+	return baseline;
+}
+
+// Times every loader stage over a synthetic level with textures, materials,
+// objects and instances. Throughput is units per second of the median run.
+static bool BenchStages(const std::filesystem::path& dir, int argc, char** argv)
+{
+	int runs = 5;
+	double tolerance = 0.25;
+	std::string baselinePath, writeBaselinePath;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+			runs = std::max(atoi(argv[++i]), 1);
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			baselinePath = argv[++i];
+		else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc)
+			writeBaselinePath = argv[++i];
+		else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+			tolerance = atof(argv[++i]);
+	}
+
+	const std::string dfxPath = (dir / "stages_synth.dfx").string();
+	const std::string vfxPath = (dir / "stages_synth.vfx").string();
+	if (!WriteSyntheticLevel(dfxPath, GetStageLevelOptions()))
+	{
+		printf("Failed to write %s\n", dfxPath.c_str());
+		return false;
+	}
+
+	std::vector<stage_t> stages = {
+		{ "readFile", &loadtimings_t::readFile, "MB" },
+		{ "textureDirectory", &loadtimings_t::textureDirectory, "textures" },
+		{ "references", &loadtimings_t::references, "Kpolygons" },
+		{ "packing", &loadtimings_t::packing, "textures" },
+		{ "textures", &loadtimings_t::textures, "Mtexels" },
+		{ "geometry", &loadtimings_t::geometry, "Kpolygons" },
+		{ "objects", &loadtimings_t::objects, "Kpolygons" },
+		{ "instances", &loadtimings_t::instances, "Kinstances" },
+		{ "meshes", &loadtimings_t::meshes, "Ktriangles" },
+	};
+
+	for (int run = 0; run < runs; ++run)
+	{
+		level_t level;
+		loadtimings_t timings;
+		loadoptions_t options;
+		options.verbose = false;
+		options.timings = &timings;
+		if (!LoadLevel(dfxPath, level, options))
+		{
+			printf("Failed to load %s\n", dfxPath.c_str());
+			return false;
+		}
+
+		if (run == 0)
+		{
+			size_t texels = 0, objectPolygons = 0, instances = 0, triangles = 0;
+			for (auto& info : level.list)
+				texels += (size_t)info.width * info.height;
+			for (auto& m : level.models)
+			{
+				if (m->addr != 0 && m->addr != 0xFFFF'FFFF)
+					objectPolygons += m->polygons.size();
+				instances += m->instances.size();
+				triangles += m->mesh.GetTriangleCount();
+			}
+
+			stages[0].amount = (std::filesystem::file_size(dfxPath) + std::filesystem::file_size(vfxPath)) / 1e6;
+			stages[1].amount = stages[3].amount = (double)level.list.size();
+			stages[2].amount = (level.models[0]->polygons.size() + objectPolygons) / 1e3;
+			stages[4].amount = texels / 1e6;
+			stages[5].amount = level.models[0]->polygons.size() / 1e3;
+			stages[6].amount = objectPolygons / 1e3;
+			stages[7].amount = instances / 1e3;
+			stages[8].amount = triangles / 1e3;
+		}
+
+		for (auto& stage : stages)
+			stage.samples.push_back(timings.*stage.time);
+		UnloadLevel(level);
+	}
+
+	std::filesystem::remove(dfxPath);
+	std::filesystem::remove(vfxPath);
+
+	const auto baseline = baselinePath.empty() ? std::map<std::string, double>{} : ReadBaseline(baselinePath);
+	if (!baselinePath.empty() && baseline.empty())
+	{
+		printf("Failed to read baseline %s\n", baselinePath.c_str());
+		return false;
+	}
+
+	std::ofstream baselineOut;
+	if (!writeBaselinePath.empty())
+		baselineOut.open(writeBaselinePath);
+
+	bool regressed = false;
+	printf("%-18s %10s %12s %-11s %14s %10s\n", "stage", "ms", "per load", "unit", "throughput/s", "baseline");
+	for (auto& stage : stages)
+	{
+		const double ms = Median(stage.samples);
+		const double throughput = ms > 0 ? stage.amount * 1000.0 / ms : 0;
+		printf("%-18s %10.3f %12.2f %-11s %14.1f", stage.name, ms, stage.amount, stage.unit, throughput);
+
+		if (auto it = baseline.find(stage.name); it != baseline.end())
+		{
+			const double ratio = it->second > 0 ? throughput / it->second : 1;
+			const bool slow = ratio < 1.0 - tolerance;
+			printf(" %9.0f%%%s", ratio * 100.0, slow ? "  REGRESSED" : "");
+			regressed |= slow;
+		}
+		printf("\n");
+
+		if (baselineOut)
+			baselineOut << stage.name << " " << throughput << "\n";
+	}
+
+	if (regressed)
+		printf("\nThroughput fell more than %.0f%% below the baseline\n", tolerance * 100.0);
+	return !regressed;
+}
+
+static bool GenerateLevel(int argc, char** argv)
+{
+	if (argc < 1)
+	{
+		printf("Usage: g2bench generate <out.dfx> [--vertices n] [--polygons n] [--object-vertices n] [--object-polygons n]\n");
+		printf("                        [--materials n] [--models n] [--instances n] [--textures n] [--seed n]\n");
+		return false;
+	}
+
+	synthleveloptions_t options = GetStageLevelOptions();
+	const std::pair<const char*, unsigned int*> flags[] = {
+		{ "--vertices", &options.levelVertexCount },
+		{ "--polygons", &options.levelPolygonCount },
+		{ "--object-vertices", &options.objectVertexCount },
+		{ "--object-polygons", &options.objectPolygonCount },
+		{ "--materials", &options.materialCount },
+		{ "--models", &options.modelCount },
+		{ "--instances", &options.instanceCount },
+		{ "--textures", &options.textureCount },
+		{ "--seed", &options.seed },
+	};
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		for (auto& [flag, value] : flags)
+			if (strcmp(argv[i], flag) == 0)
+				*value = (unsigned int)strtoul(argv[i + 1], nullptr, 10);
+	}
+
+	if (!WriteSyntheticLevel(argv[0], options))
+	{
+		printf("Failed to write %s\n", argv[0]);
+		return false;
+	}
+	return true;
+}
+
+// The YIQ422 arithmetic as the loader did it per texel, before the table
+static rgba8_t DecodeYIQ422Reference(unsigned char in, const unsigned char yRGB[16], const short iRGB[4][3], const short qRGB[4][3])
+{
+	auto signExtend = [](short v) { return (int)(short)((v & 0x100) ? (v | 0xFF00) : v); };
+	int rgb[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		int v = yRGB[in >> 4] + signExtend(iRGB[(in >> 2) & 0x3][c]) + signExtend(qRGB[in & 0x3][c]);
+		rgb[c] = v < 0 ? 0 : (v > 255 ? 255 : v);
+	}
+	return { (unsigned char)rgb[0], (unsigned char)rgb[1], (unsigned char)rgb[2], 0xFF };
+}
+
+static bool SameTexels(const std::vector<rgba8_t>& a, const std::vector<rgba8_t>& b)
+{
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(rgba8_t)) == 0;
+}
+
+struct benchformat_t
+{
+	const char* name;
+	GrTextureFormat_t format;
+};
+
+static const benchformat_t c_BENCHFORMATS[] = {
+	{ "RGB332", GR_TEXFMT_RGB_332 },
+	{ "YIQ422", GR_TEXFMT_YIQ_422 },
+	{ "A8", GR_TEXFMT_ALPHA_8 },
+	{ "I8", GR_TEXFMT_INTENSITY_8 },
+	{ "AI44", GR_TEXFMT_ALPHA_INTENSITY_44 },
+	{ "P8", GR_TEXFMT_P_8 },
+	{ "ARGB8332", GR_TEXFMT_ARGB_8332 },
+	{ "AYIQ8422", GR_TEXFMT_AYIQ_8422 },
+	{ "RGB565", GR_TEXFMT_RGB_565 },
+	{ "ARGB1555", GR_TEXFMT_ARGB_1555 },
+	{ "ARGB4444", GR_TEXFMT_ARGB_4444 },
+	{ "AI88", GR_TEXFMT_ALPHA_INTENSITY_88 },
+	{ "AP88", GR_TEXFMT_AP_88 },
+};
+
+// Checks every SIMD level against the scalar decoders over every possible
+// input, then measures each format's decode rate at every level.
+static bool BenchTextureDecoders()
+{
+	std::vector<Simd::Level_t> levels = { Simd::Level_t::Scalar };
+	if (Simd::GetLevel() >= Simd::Level_t::SSE2)
+		levels.push_back(Simd::Level_t::SSE2);
+	if (Simd::GetLevel() >= Simd::Level_t::AVX2)
+		levels.push_back(Simd::Level_t::AVX2);
+
+	// Every 16-bit texel once, which also holds every byte for the 8-bit formats
+	std::vector<unsigned char> words(0x10000 * 2);
+	for (size_t i = 0; i < 0x10000; ++i)
+	{
+		words[i * 2 + 0] = (unsigned char)i;
+		words[i * 2 + 1] = (unsigned char)(i >> 8);
+	}
+
+	std::mt19937 rng(1);
+	unsigned char yRGB[16];
+	short iRGB[4][3], qRGB[4][3];
+	texturetables_t tables;
+	auto randomizeTables = [&]()
+		{
+			for (auto& y : yRGB)
+				y = (unsigned char)rng();
+			for (int i = 0; i < 4; ++i)
+				for (int c = 0; c < 3; ++c)
+				{
+					iRGB[i][c] = (short)(rng() % 0x200);
+					qRGB[i][c] = (short)(rng() % 0x200);
+				}
+			BuildYIQTable(yRGB, iRGB, qRGB, tables.yiq);
+
+			unsigned char palette[c_PALETTEBYTES];
+			for (auto& b : palette)
+				b = (unsigned char)rng();
+			BuildPaletteTable(palette, tables.palette);
+		};
+	randomizeTables();
+
+	bool ok = true;
+	for (auto& format : c_BENCHFORMATS)
+	{
+		// Odd lengths so the scalar tails run too
+		const size_t maxCount = words.size() / GetTexelSize(format.format);
+		for (size_t count : { maxCount, maxCount - 17, (size_t)7 })
+		{
+			std::vector<rgba8_t> expect(count);
+			DecodeTexels(format.format, words, count, tables, expect.data(), Simd::Level_t::Scalar);
+			for (auto level : levels)
+			{
+				std::vector<rgba8_t> out(count);
+				DecodeTexels(format.format, words, count, tables, out.data(), level);
+				if (!SameTexels(out, expect))
+				{
+					printf("%s %s differs from scalar over %zu texels\n", format.name, Simd::GetLevelName(level), count);
+					ok = false;
+				}
+			}
+		}
+	}
+
+	// Every byte under many tables, against the per-texel arithmetic
+	std::vector<unsigned char> bytes(256 + 5);
+	for (size_t i = 0; i < bytes.size(); ++i)
+		bytes[i] = (unsigned char)i;
+	for (int table = 0; table < 256 && ok; ++table)
+	{
+		randomizeTables();
+
+		std::vector<rgba8_t> expect(bytes.size());
+		for (size_t i = 0; i < bytes.size(); ++i)
+			expect[i] = DecodeYIQ422Reference(bytes[i], yRGB, iRGB, qRGB);
+
+		for (auto level : levels)
+		{
+			std::vector<rgba8_t> out(bytes.size());
+			DecodeTexels<GR_TEXFMT_YIQ_422>(bytes, bytes.size(), tables, out.data(), level);
+			if (!SameTexels(out, expect))
+			{
+				printf("YIQ422 %s differs from the reference for table %d\n", Simd::GetLevelName(level), table);
+				ok = false;
+			}
+		}
+	}
+
+	if (!ok)
+		return false;
+	printf("Decoders match the scalar path over every input\n\n");
+
+	// Throughput over 16 MB of source texels, median of several runs
+	constexpr size_t c_BYTES = 16 * 1024 * 1024;
+	constexpr int c_RUNS = 7;
+	std::vector<unsigned char> src(c_BYTES);
+	for (auto& b : src)
+		b = (unsigned char)rng();
+	std::vector<rgba8_t> out(c_BYTES);
+	randomizeTables();
+
+	printf("%-10s %-8s %12s %14s %10s\n", "format", "level", "MB/s in", "Mtexels/s", "speedup");
+	for (auto& format : c_BENCHFORMATS)
+	{
+		const size_t count = c_BYTES / GetTexelSize(format.format);
+		double scalarMs = 0;
+		for (auto level : levels)
+		{
+			std::vector<double> samples;
+			for (int run = 0; run < c_RUNS; ++run)
+			{
+				auto start = clock_type::now();
+				DecodeTexels(format.format, src, count, tables, out.data(), level);
+				samples.push_back(MillisecondsSince(start));
+			}
+			const double ms = Median(samples);
+			if (level == Simd::Level_t::Scalar)
+				scalarMs = ms;
+			printf("%-10s %-8s %12.0f %14.0f %9.2fx\n", format.name, Simd::GetLevelName(level),
+				c_BYTES / 1e6 * 1000.0 / ms, count / 1e6 * 1000.0 / ms, scalarMs / ms);
+		}
+	}
+
+	return true;
+}
+
+// Packs synthetic texture sets with the AtlasTree and skyline packers. Sizes
+// are powers of two between 8 and 256 like Glide textures, weighted towards
+// the small ones. Each set is packed bare and with the loader's gutter. Sets
+// too large for one sheet fail with AtlasTree and spill onto more pages with
+// the skyline packer.
+static bool BenchPacking()
+{
+	const size_t imageCounts[] = { 100, 1000, 10000 };
+	std::mt19937 rng(1234);
+
+	printf("%-8s %-7s %-10s %10s %13s %14s %11s\n", "images", "gutter", "packer", "time (ms)", "sheet", "wasted texels", "efficiency");
+	for (size_t count : imageCounts)
+	{
+		ImagePacker::ImageInformationList images;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const int w = 8 << std::min({ rng() % 6, rng() % 6, rng() % 6 });
+			const int aspect = (int)(rng() % 3) - 1;
+			const int h = std::clamp(aspect < 0 ? w / 2 : aspect > 0 ? w * 2 : w, 8, 256);
+			images.emplace_back(w, h, (void*)(uintptr_t)i);
+		}
+
+		size_t imageTexels = 0;
+		for (auto& info : images)
+			imageTexels += (size_t)info.width * info.height;
+
+		for (int gutter : { 0, c_ATLASGUTTER })
+		{
+			auto report = [&](const char* name, int w, int h, int pages, double ms)
+				{
+					char sheet[32] = "failed";
+					if (pages == 1)
+						snprintf(sheet, sizeof(sheet), "%dx%d", w, h);
+					else if (pages > 1)
+						snprintf(sheet, sizeof(sheet), "%dx%dx%d", w, h, pages);
+					const size_t sheetTexels = (size_t)w * h * pages;
+					printf("%-8zu %-7d %-10s %10.2f %13s %14zu %10.1f%%\n", count, gutter, name, ms, sheet,
+						pages != 0 ? sheetTexels - imageTexels : 0, pages != 0 ? imageTexels * 100.0 / sheetTexels : 0.0);
+				};
+
+			// Every placed image has to stay inside the sheet and clear of the others' gutters
+			auto validate = [&](const char* name, int w, int h, int pages, const ImagePacker::ImageInformationList& list)
+				{
+					std::vector<unsigned char> used((size_t)w * h * pages);
+					for (auto& info : list)
+					{
+						// Pages stacked vertically
+						const int x0 = info.x - gutter, y0 = info.y - gutter;
+						const int x1 = info.x + info.width + gutter, y1 = info.y + info.height + gutter;
+						if (x0 < 0 || y0 < 0 || x1 > w || y1 > h || info.page < 0 || info.page >= pages)
+						{
+							printf("%s placed a %dx%d image outside the sheet\n", name, info.width, info.height);
+							return false;
+						}
+						for (int y = y0; y < y1; ++y)
+							for (int x = x0; x < x1; ++x)
+							{
+								const size_t texel = ((size_t)info.page * h + y) * w + x;
+								if (used[texel])
+								{
+									printf("%s overlapped images at %d,%d on page %d\n", name, x, y, info.page);
+									return false;
+								}
+								used[texel] = 1;
+							}
+					}
+					return true;
+				};
+
+			ImagePacker::ImageInformationList tree = images;
+			auto start = clock_type::now();
+			const int treeSize = ImagePacker::GeneratePackedList(tree, 256, gutter);
+			report("atlastree", treeSize, treeSize, treeSize != 0 ? 1 : 0, MillisecondsSince(start));
+
+			ImagePacker::ImageInformationList skyline = images;
+			start = clock_type::now();
+			const ImagePacker::PackResult_t packed = ImagePacker::Pack(skyline, gutter);
+			report("skyline", packed.width, packed.height, packed.pages, MillisecondsSince(start));
+
+			if ((treeSize != 0 && !validate("atlastree", treeSize, treeSize, 1, tree))
+				|| (packed.pages != 0 && !validate("skyline", packed.width, packed.height, packed.pages, skyline)))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Compresses the stage level's atlas to BC1 and BC3. The pooled compressor has
+// to match a serial pass byte for byte, and a cooked level has to bring the
+// same blocks back. PSNR is measured on level 0 against the uncompressed sheet.
+static bool BenchCompression(const std::filesystem::path& dir)
+{
+	constexpr int c_RUNS = 5;
+
+	const std::string path = (dir / "compress_synth.dfx").string();
+	if (!WriteSyntheticLevel(path, GetStageLevelOptions()))
+	{
+		printf("Failed to write %s\n", path.c_str());
+		return false;
+	}
+
+	const std::filesystem::path cacheDir = dir / "g2bench_compress_cache";
+	std::filesystem::remove_all(cacheDir);
+
+	loadoptions_t options;
+	options.verbose = false;
+	options.compressAtlas = true;
+	options.cacheDirectory = cacheDir.string();
+
+	level_t level, cached;
+	bool ok = LoadLevel(path, level, options) && !level.fromCache && level.compressedFormat != BlockFormat_t::None;
+	ok = ok && LoadLevel(path, cached, options) && cached.fromCache && cached.compressedFormat == level.compressedFormat
+		&& cached.compressedSheet.size() == level.compressedSheet.size()
+		&& memcmp(cached.compressedSheet.data(), level.compressedSheet.data(), level.compressedSheet.size()) == 0;
+	UnloadLevel(cached);
+	std::filesystem::remove(path);
+	std::filesystem::remove_all(cacheDir);
+	if (!ok)
+	{
+		printf("Compressed atlas did not survive the cache round trip\n");
+		UnloadLevel(level);
+		return false;
+	}
+
+	const texture_t& sheet = level.sheet;
+	const unsigned int pages = level.sheetPages;
+	const size_t texels = GetAtlasTexelCount(sheet.w, sheet.h, level.sheetLevels, pages);
+	printf("atlas %ux%ux%u, %u levels, %s chosen\n\n", sheet.w, sheet.h, pages, level.sheetLevels, GetBlockFormatName(level.compressedFormat));
+	printf("%-7s %10s %14s %12s %8s %10s\n", "format", "time (ms)", "Mtexels/s", "size (KiB)", "ratio", "PSNR (dB)");
+
+	for (BlockFormat_t format : { BlockFormat_t::BC1, BlockFormat_t::BC3 })
+	{
+		const size_t bytes = GetCompressedAtlasSize(sheet.w, sheet.h, level.sheetLevels, pages, format);
+		std::vector<unsigned char> pooled(bytes), serial(bytes);
+
+		std::vector<double> samples;
+		for (int run = 0; run < c_RUNS; ++run)
+		{
+			auto start = clock_type::now();
+			CompressAtlas(sheet, level.sheetLevels, pages, format, pooled.data(), ThreadPool::Get());
+			samples.push_back(MillisecondsSince(start));
+		}
+
+		for (unsigned int mip = 0; mip < level.sheetLevels; ++mip)
+		{
+			const texture_t tall = GetAtlasLevel(sheet, mip, pages);
+			const unsigned int h = tall.h / pages;
+			for (unsigned int page = 0; page < pages; ++page)
+			{
+				const texture_t image = { tall.w, h, tall.pixels + (size_t)page * tall.w * h };
+				CompressBlockRows(image, format, 0, (h + 3) / 4, serial.data() + GetCompressedAtlasOffset(sheet.w, sheet.h, mip, page, pages, format));
+			}
+		}
+		if (pooled != serial)
+		{
+			printf("%s: pooled compression differs from the serial pass\n", GetBlockFormatName(format));
+			UnloadLevel(level);
+			return false;
+		}
+
+		// Level 0 of every page against the source texels, alpha included
+		double squaredError = 0;
+		std::vector<rgba8_t> decoded((size_t)sheet.w * sheet.h);
+		for (unsigned int page = 0; page < pages; ++page)
+		{
+			texture_t image = { sheet.w, sheet.h, decoded.data() };
+			DecompressImage(pooled.data() + GetCompressedAtlasOffset(sheet.w, sheet.h, 0, page, pages, format), format, image);
+			const rgba8_t* source = sheet.pixels + (size_t)page * sheet.w * sheet.h;
+			for (size_t i = 0; i < decoded.size(); ++i)
+			{
+				const int d[4] = { decoded[i].r - source[i].r, decoded[i].g - source[i].g, decoded[i].b - source[i].b, decoded[i].a - source[i].a };
+				squaredError += d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + d[3] * d[3];
+			}
+		}
+		const double mse = squaredError / ((double)sheet.w * sheet.h * pages * 4);
+		const double psnr = mse > 0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+
+		const double ms = Median(samples);
+		printf("%-7s %10.2f %14.1f %12.1f %7.1fx %10.2f\n", GetBlockFormatName(format), ms, texels / (ms * 1000.0),
+			bytes / 1024.0, texels * 4.0 / bytes, psnr);
+	}
+
+	UnloadLevel(level);
+	return true;
+}
+
+// Loads the stage level under shrinking texture budgets, uncompressed and
+// block compressed. Every budget has to be met, and each downscaled texture
+// has to sit in the atlas at its reduced size.
+static bool BenchBudget(const std::filesystem::path& dir)
+{
+	const std::string path = (dir / "budget_synth.dfx").string();
+	if (!WriteSyntheticLevel(path, GetStageLevelOptions()))
+	{
+		printf("Failed to write %s\n", path.c_str());
+		return false;
+	}
+
+	bool ok = true;
+	printf("%-8s %12s %12s %-9s %12s %10s %10s\n", "atlas", "budget (MB)", "atlas (MB)", "format", "downscaled", "stored", "load (ms)");
+	for (bool compress : { false, true })
+	{
+		size_t fullBytes = 0;
+		for (unsigned int divisor : { 0u, 1u, 2u, 4u, 8u, 16u })
+		{
+			loadoptions_t options;
+			options.verbose = false;
+			options.compressAtlas = compress;
+			options.textureBudget = divisor != 0 ? fullBytes / divisor : 0;
+
+			level_t level;
+			auto start = clock_type::now();
+			if (!LoadLevel(path, level, options))
+			{
+				printf("Failed to load %s\n", path.c_str());
+				ok = false;
+				break;
+			}
+			const double ms = MillisecondsSince(start);
+
+			const size_t bytes = GetAtlasBytes(level.sheet.w, level.sheet.h, level.sheetLevels, level.sheetPages, level.compressedFormat, level.atlasFormat);
+			if (divisor == 0)
+				fullBytes = bytes;
+
+			size_t stored = 0;
+			for (auto& degraded : level.degradedTextures)
+			{
+				stored += degraded.storedLevel ? 1 : 0;
+				const ImagePacker::ImageInformation_t* info = nullptr;
+				for (auto& image : level.list)
+				{
+					if ((uintptr_t)image.userdata == degraded.texture)
+						info = &image;
+				}
+				if (!info || info->width != (int)GetMipSize(degraded.width, degraded.droppedLevels) || info->height != (int)GetMipSize(degraded.height, degraded.droppedLevels))
+				{
+					printf("Texture %u is not packed at its downscaled size\n", degraded.texture);
+					ok = false;
+				}
+			}
+			// Over budget is only fine once nothing can shrink any further
+			bool atFloor = true;
+			for (auto& image : level.list)
+				atFloor = atFloor && std::max(image.width, image.height) <= c_BUDGETMINSIZE;
+			if (options.textureBudget != 0 && bytes > options.textureBudget && !atFloor)
+			{
+				printf("Atlas of %zu bytes is over the %zu byte budget\n", bytes, options.textureBudget);
+				ok = false;
+			}
+
+			const char* format = level.compressedFormat != BlockFormat_t::None ? GetBlockFormatName(level.compressedFormat) : GetAtlasFormatName(level.atlasFormat);
+			printf("%-8s %12.2f %12.2f %-9s %12zu %10zu %10.2f%s\n", compress ? "bc" : "rgba", options.textureBudget / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0),
+				format, level.degradedTextures.size(), stored, ms, bytes > options.textureBudget && options.textureBudget != 0 ? "  (smallest possible)" : "");
+			UnloadLevel(level);
+		}
+	}
+
+	std::filesystem::remove(path);
+	return ok;
+}
+
+// Builds the stage level's meshes and checks that every triangle corner,
+// looked up through the index buffer, is the quantized corner it came from.
+// Reports the indexed size against one float vertex per corner.
+static bool BenchMeshes(const std::filesystem::path& dir)
+{
+	const std::string path = (dir / "meshes_synth.dfx").string();
+	if (!WriteSyntheticLevel(path, GetStageLevelOptions()))
+	{
+		printf("Failed to write %s\n", path.c_str());
+		return false;
+	}
+
+	loadoptions_t options;
+	options.verbose = false;
+	level_t level;
+	const bool loaded = LoadLevel(path, level, options);
+	std::filesystem::remove(path);
+	if (!loaded)
+	{
+		printf("Failed to load %s\n", path.c_str());
+		return false;
+	}
+
+	bool ok = true;
+	for (auto& model : level.models)
+	{
+		const mesh_t& mesh = model->mesh;
+		const unsigned int wantSize = mesh.vertices.size() <= 0x10000 ? 2 : 4;
+		if (mesh.GetIndexCount() != model->polygons.size() * 3 || mesh.indexSize != wantSize)
+		{
+			printf("Model %08X has %zu indices of %u bytes for %zu polygons\n", model->addr, mesh.GetIndexCount(), mesh.indexSize, model->polygons.size());
+			ok = false;
+			continue;
+		}
+
+		for (size_t i = 0; i < mesh.GetIndexCount() && ok; ++i)
+		{
+			const auto& polygon = model->polygons[i / 3];
+			const auto& source = model->vertices[polygon.vertex[i % 3]];
+			const glm::vec3& uv = polygon.uvs[i % 3];
+			const uint32_t index = mesh.GetIndex(i);
+			if (index >= mesh.vertices.size())
+			{
+				printf("Model %08X index %zu is out of range\n", model->addr, i);
+				ok = false;
+				break;
+			}
+			const Vertex& v = mesh.vertices[index];
+			const bool same = v.position[0] == source.x && v.position[1] == source.y && v.position[2] == source.z
+				&& v.page == (short)uv.z && v.color[0] == source.r && v.color[1] == source.g && v.color[2] == source.b
+				&& v.color[3] == (polygon.materialID == 0xFFFF'FFFF ? 0 : source.a)
+				&& std::abs(v.uv[0] / 65535.f - uv.x) <= 0.5f / 65535.f + 1e-6f && std::abs(v.uv[1] / 65535.f - uv.y) <= 0.5f / 65535.f + 1e-6f;
+			if (!same)
+			{
+				printf("Model %08X corner %zu does not match its polygon\n", model->addr, i);
+				ok = false;
+			}
+		}
+	}
+
+	const meshstats_t& stats = level.meshStats;
+	printf("%-10s %10s %14s %14s %12s\n", "corners", "vertices", "expanded (MB)", "indexed (MB)", "build (ms)");
+	printf("%-10zu %10zu %14.2f %14.2f %12.2f  (%.1fx smaller)\n", stats.corners, stats.vertices, stats.GetExpandedBytes() / (1024.0 * 1024.0),
+		stats.GetBytes() / (1024.0 * 1024.0), stats.buildMs, stats.GetExpandedBytes() / (double)stats.GetBytes());
+	UnloadLevel(level);
+	return ok;
+}
+
+// Checks that every model drawn through the merged arena, at its base vertex
+// and first index, gives back its own mesh
+static bool CheckSceneArena(const level_t& level, const scenearena_t& arena)
+{
+	std::vector<Vertex> vertices(arena.vertexCount);
+	std::vector<unsigned char> indices(arena.GetIndexBytes());
+	for (size_t m = 0; m < level.models.size(); ++m)
+	{
+		const mesh_t& mesh = level.models[m]->mesh;
+		const arenarange_t& range = arena.ranges[m];
+		std::copy(mesh.vertices.begin(), mesh.vertices.end(), vertices.begin() + range.baseVertex);
+		CopyArenaIndices(mesh, 0, range.indexCount, arena.indexSize, indices.data() + (size_t)range.firstIndex * arena.indexSize);
+	}
+
+	for (size_t m = 0; m < level.models.size(); ++m)
+	{
+		const mesh_t& mesh = level.models[m]->mesh;
+		const arenarange_t& range = arena.ranges[m];
+		if (range.vertexCount != mesh.vertices.size() || range.indexCount != mesh.GetIndexCount())
+		{
+			printf("Model %08X has the wrong range in the arena\n", level.models[m]->addr);
+			return false;
+		}
+		for (size_t i = 0; i < range.indexCount; ++i)
+		{
+			uint32_t index = 0;
+			memcpy(&index, indices.data() + (range.firstIndex + i) * arena.indexSize, arena.indexSize);
+			const size_t vertex = range.baseVertex + (size_t)index;
+			if (vertex >= vertices.size() || memcmp(&vertices[vertex], &mesh.vertices[mesh.GetIndex(i)], sizeof(Vertex)) != 0)
+			{
+				printf("Model %08X index %zu does not resolve to its vertex in the arena\n", level.models[m]->addr, i);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Checks that the commands cover exactly the candidates flagged visible, in
+// order, with one command per run of the same model chunk
+static bool CheckSceneDraws(const level_t& level, const scenearena_t& arena, const scenecandidates_t& candidates, const std::vector<unsigned char>& visible,
+	const std::vector<sceneinstance_t>& instances, const std::vector<drawcommand_t>& commands)
+{
+	size_t next = 0, command = 0;
+	const scenedrawable_t* previous = nullptr;
+	for (size_t i = 0; i < candidates.drawables.size(); ++i)
+	{
+		if (!visible[i])
+			continue;
+		const scenedrawable_t& drawable = candidates.drawables[i];
+		if (!previous || previous->model != drawable.model || previous->chunk != drawable.chunk)
+		{
+			if (command >= commands.size() || (command > 0 && commands[command - 1].baseInstance + commands[command - 1].instanceCount != next))
+				return false;
+			const meshchunk_t& chunk = level.models[drawable.model]->mesh.chunks[drawable.chunk];
+			const arenarange_t& range = arena.ranges[drawable.model];
+			const drawcommand_t& c = commands[command++];
+			if (c.baseInstance != next || c.firstIndex != range.firstIndex + chunk.firstIndex || c.count != chunk.indexCount
+				|| c.baseVertex != (int32_t)range.baseVertex)
+				return false;
+		}
+		if (next >= instances.size() || memcmp(&instances[next], &drawable.instance, sizeof(sceneinstance_t)) != 0)
+			return false;
+		++next;
+		previous = &drawable;
+	}
+	return command == commands.size() && next == instances.size()
+		&& (commands.empty() || commands.back().baseInstance + commands.back().instanceCount == next);
+}
+
+// Chunks per visible instance the candidates should hold
+static size_t CountSceneCandidates(const level_t& level)
+{
+	size_t count = 0;
+	for (auto& model : level.models)
+	{
+		if (!model->objectVisibility)
+			continue;
+		for (auto& inst : model->instances)
+			count += inst.isVisible ? model->mesh.chunks.size() : 0;
+	}
+	return count;
+}
+
+// Lays a stress scene of 10k instances out in one arena and times building its
+// indirect draws, with nothing culled, as the number of models grows. A
+// multi-draw indirect submits the scene in one call whatever the count, the
+// fallback makes one call a model chunk and drawing every instance on its own,
+// as the viewer used to, one an instance.
+static bool BenchSceneArena(const std::filesystem::path& dir)
+{
+	printf("Draw calls a frame with multi-draw indirect, the base vertex fallback and a draw per instance\n");
+	printf("%-8s %10s %10s %10s %12s %12s %14s %12s\n", "models", "instances", "vertices", "arena (MB)", "multi-draw", "base vertex", "per instance", "build (ms)");
+	bool ok = true;
+	for (unsigned int models : { 16u, 128u, 1024u })
+	{
+		synthleveloptions_t synth = GetStageLevelOptions();
+		synth.modelCount = models;
+		synth.instanceCount = 10'000;
+		synth.materialCount = 0;
+		synth.textureCount = 0;
+		const std::string path = (dir / "arena_synth.dfx").string();
+		if (!WriteSyntheticLevel(path, synth))
+		{
+			printf("Failed to write %s\n", path.c_str());
+			return false;
+		}
+
+		loadoptions_t options;
+		options.verbose = false;
+		level_t level;
+		const bool loaded = LoadLevel(path, level, options);
+		std::filesystem::remove(path);
+		if (!loaded)
+		{
+			printf("Failed to load %s\n", path.c_str());
+			return false;
+		}
+
+		const scenearena_t arena = LayoutSceneArena(level.models);
+		if (!CheckSceneArena(level, arena))
+			ok = false;
+
+		std::vector<bool> billboards(level.models.size(), false);
+		scenecandidates_t candidates;
+		BuildSceneCandidates(level.models, level.models.size(), billboards, candidates);
+		std::vector<unsigned char> visible(candidates.drawables.size(), 1);
+		std::vector<sceneinstance_t> instances;
+		std::vector<drawcommand_t> commands;
+		std::vector<double> times;
+		scenedrawcounts_t counts;
+		for (int run = 0; run < 5; ++run)
+		{
+			const auto start = clock_type::now();
+			counts = BuildSceneDraws(level.models, arena, candidates, visible.data(), instances, commands);
+			times.push_back(MillisecondsSince(start));
+		}
+		if (candidates.drawables.size() != CountSceneCandidates(level) || !CheckSceneDraws(level, arena, candidates, visible, instances, commands))
+		{
+			printf("Draws of %u models do not match the visible instances\n", models);
+			ok = false;
+		}
+		const size_t instanceCount = counts.objectInstancesDrawn + (counts.levelChunksDrawn != 0), commandCount = commands.size();
+
+		// Gathering again after hiding instances and a model
+		for (auto& model : level.models)
+		{
+			for (size_t i = 0; i < model->instances.size(); i += 2)
+				model->instances[i].isVisible = false;
+		}
+		level.models.back()->objectVisibility = false;
+		BuildSceneCandidates(level.models, level.models.size(), billboards, candidates);
+		visible.assign(candidates.drawables.size(), 1);
+		BuildSceneDraws(level.models, arena, candidates, visible.data(), instances, commands);
+		if (candidates.drawables.size() != CountSceneCandidates(level) || !CheckSceneDraws(level, arena, candidates, visible, instances, commands))
+		{
+			printf("Compacted draws of %u models do not match the visible instances\n", models);
+			ok = false;
+		}
+
+		printf("%-8zu %10zu %10zu %10.2f %12d %12zu %14zu %12.3f\n", level.models.size(), instanceCount, arena.vertexCount,
+			(arena.GetVertexBytes() + arena.GetIndexBytes()) / (1024.0 * 1024.0), 1, commandCount, instanceCount, Median(times));
+		UnloadLevel(level);
+	}
+	return ok;
+}
+
+// Checks that a model's chunks cover its indices in order and that each one's
+// bounds hold the vertices of its triangles
+static bool CheckMeshChunks(const Model& model)
+{
+	const mesh_t& mesh = model.mesh;
+	size_t next = 0;
+	for (const meshchunk_t& chunk : mesh.chunks)
+	{
+		if (chunk.firstIndex != next || chunk.indexCount == 0 || chunk.indexCount % 3 != 0)
+			return false;
+		for (size_t i = chunk.firstIndex; i < (size_t)chunk.firstIndex + chunk.indexCount; ++i)
+		{
+			const Vertex& v = mesh.vertices[mesh.GetIndex(i)];
+			for (int c = 0; c < 3; ++c)
+			{
+				if (v.position[c] < chunk.min[c] || v.position[c] > chunk.max[c])
+					return false;
+			}
+		}
+		next += chunk.indexCount;
+	}
+	return next == mesh.GetIndexCount();
+}
+
+// Swaps a level's random triangles, which each span the whole level, for a
+// height field whose triangles are local the way a real level's are
+static void BuildTerrainGrid(Model& level, unsigned int cells, short spacing)
+{
+	level.vertices.clear();
+	level.polygons.clear();
+	const int half = (int)cells * spacing / 2;
+	for (unsigned int z = 0; z <= cells; ++z)
+	{
+		for (unsigned int x = 0; x <= cells; ++x)
+		{
+			const short height = (short)((x * 37 + z * 91) % 256);
+			level.vertices.push_back({ (short)(x * spacing - half), height, (short)(z * spacing - half), 0, 0, 0, 0, 128, 128, 128, 255 });
+		}
+	}
+	for (unsigned int z = 0; z < cells; ++z)
+	{
+		for (unsigned int x = 0; x < cells; ++x)
+		{
+			const size_t corner = z * (cells + 1) + x;
+			level.polygons.push_back({ { corner, corner + 1, corner + cells + 1 }, 0xFFFF'FFFF, 0, {} });
+			level.polygons.push_back({ { corner + 1, corner + cells + 2, corner + cells + 1 }, 0xFFFF'FFFF, 0, {} });
+		}
+	}
+	BuildMesh(level, c_LEVELCHUNKTRIANGLES);
+}
+
+// True when every vertex of the drawable, placed as the vertex shader does,
+// is outside the same clip plane, so culling it hid nothing
+static bool IsOutsideClipPlane(const Model& model, const scenedrawable_t& drawable, const glm::mat4& viewProjection)
+{
+	const meshchunk_t& chunk = model.mesh.chunks[drawable.chunk];
+	const float c = std::cos(drawable.instance.yaw), s = std::sin(drawable.instance.yaw);
+	unsigned int outside = 0x3F;
+	for (size_t i = chunk.firstIndex; i < (size_t)chunk.firstIndex + chunk.indexCount && outside != 0; ++i)
+	{
+		const Vertex& v = model.mesh.vertices[model.mesh.GetIndex(i)];
+		const glm::vec3 local = glm::vec3(v.position[0], v.position[1], v.position[2]) * 0.001f;
+		const glm::vec3 world = glm::vec3(c * local.x + s * local.z, local.y, c * local.z - s * local.x) + drawable.instance.position;
+		const glm::vec4 clip = viewProjection * glm::vec4(world, 1.f);
+		unsigned int mask = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			mask |= (clip[axis] < -clip.w) << (axis * 2);
+			mask |= (clip[axis] > clip.w) << (axis * 2 + 1);
+		}
+		outside &= mask;
+	}
+	return outside != 0;
+}
+
+// Tests random boxes against random frustums with every SIMD level, which must
+// match the scalar test, then culls the stage level, with a terrain grid for
+// geometry, from a few cameras and checks nothing culled could be on screen
+static bool BenchCulling(const std::filesystem::path& dir)
+{
+	std::vector<Simd::Level_t> levels = { Simd::Level_t::Scalar };
+	if (Simd::GetLevel() >= Simd::Level_t::SSE2)
+		levels.push_back(Simd::Level_t::SSE2);
+	if (Simd::GetLevel() >= Simd::Level_t::AVX2)
+		levels.push_back(Simd::Level_t::AVX2);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> position(-50.f, 50.f), size(0.f, 5.f), angle(0.f, glm::two_pi<float>());
+	auto randomViewProjection = [&]()
+		{
+			const glm::vec3 eye(position(rng), position(rng) * 0.2f, position(rng));
+			const glm::vec3 forward(std::cos(angle(rng)), std::sin(angle(rng)) * 0.5f, std::sin(angle(rng)));
+			return glm::perspective(glm::pi<float>() * 0.25f, 16.f / 9.f, 0.1f, 100.f) * glm::lookAt(eye, eye + forward, glm::vec3(0.f, 1.f, 0.f));
+		};
+
+	// 100k boxes plus a tail that no vector covers
+	cullboxes_t boxes;
+	for (size_t i = 0; i < 100'003; ++i)
+	{
+		const float center[3] = { position(rng), position(rng) * 0.2f, position(rng) };
+		const float extent[3] = { size(rng), size(rng), size(rng) };
+		boxes.push_back(center, extent);
+	}
+
+	bool ok = true;
+	constexpr int c_FRUSTUMS = 64;
+	std::vector<frustum_t> frustums;
+	for (int i = 0; i < c_FRUSTUMS; ++i)
+		frustums.push_back(ExtractFrustum(glm::value_ptr(randomViewProjection())));
+	std::vector<unsigned char> expect(boxes.size()), visible(boxes.size());
+	printf("%-8s %10s %10s %12s %10s\n", "level", "boxes", "visible", "Mboxes/s", "speedup");
+	double scalarRate = 0;
+	for (Simd::Level_t level : levels)
+	{
+		size_t visibleCount = 0;
+		for (const frustum_t& frustum : frustums)
+		{
+			const size_t expectCount = CullBoxes(frustum, boxes, expect.data(), Simd::Level_t::Scalar);
+			const size_t count = CullBoxes(frustum, boxes, visible.data(), level);
+			if (count != expectCount || visible != expect)
+			{
+				printf("%s culling differs from scalar\n", Simd::GetLevelName(level));
+				ok = false;
+				break;
+			}
+			visibleCount += count;
+		}
+
+		std::vector<double> times;
+		for (int run = 0; run < 5; ++run)
+		{
+			const auto start = clock_type::now();
+			for (const frustum_t& frustum : frustums)
+				CullBoxes(frustum, boxes, visible.data(), level);
+			times.push_back(MillisecondsSince(start));
+		}
+		const double rate = boxes.size() * (double)c_FRUSTUMS / (Median(times) * 1000.0);
+		if (level == Simd::Level_t::Scalar)
+			scalarRate = rate;
+		printf("%-8s %10zu %10zu %12.1f %9.2fx\n", Simd::GetLevelName(level), boxes.size(), visibleCount / c_FRUSTUMS, rate, rate / scalarRate);
+	}
+
+	const std::string path = (dir / "culling_synth.dfx").string();
+	if (!WriteSyntheticLevel(path, GetStageLevelOptions()))
+	{
+		printf("Failed to write %s\n", path.c_str());
+		return false;
+	}
+	loadoptions_t options;
+	options.verbose = false;
+	level_t level;
+	const bool loaded = LoadLevel(path, level, options);
+	std::filesystem::remove(path);
+	if (!loaded)
+	{
+		printf("Failed to load %s\n", path.c_str());
+		return false;
+	}
+
+	for (auto& model : level.models)
+	{
+		if (!CheckMeshChunks(*model))
+		{
+			printf("Model %08X chunks do not cover its triangles\n", model->addr);
+			ok = false;
+		}
+	}
+	const size_t synthChunks = level.models[0]->mesh.chunks.size();
+	BuildTerrainGrid(*level.models[0], 256, 32);
+	if (!CheckMeshChunks(*level.models[0]))
+	{
+		printf("Terrain chunks do not cover its triangles\n");
+		ok = false;
+	}
+	printf("Stage level: %zu chunks, terrain grid: %zu chunks of %zu triangles\n", synthChunks, level.models[0]->mesh.chunks.size(),
+		level.models[0]->mesh.GetTriangleCount());
+
+	// The synthetic objects are as big as the level, shrink them to props and
+	// scatter their instances over the terrain
+	std::uniform_real_distribution<float> ground(-4.f, 4.f);
+	for (size_t m = 1; m < level.models.size(); ++m)
+	{
+		Model& model = *level.models[m];
+		for (auto& v : model.vertices)
+		{
+			v.x /= 16;
+			v.y /= 16;
+			v.z /= 16;
+		}
+		BuildMesh(model);
+		for (auto& inst : model.instances)
+			inst.position = glm::vec3(ground(rng), -0.2f, ground(rng));
+	}
+
+	const scenearena_t arena = LayoutSceneArena(level.models);
+	std::vector<bool> billboards(level.models.size());
+	for (size_t i = 0; i < level.models.size(); ++i)
+		billboards[i] = i % 8 == 1;
+	scenecandidates_t candidates;
+	BuildSceneCandidates(level.models, level.models.size(), billboards, candidates);
+	visible.resize(candidates.drawables.size());
+	std::vector<sceneinstance_t> instances;
+	std::vector<drawcommand_t> commands;
+
+	struct camera_t
+	{
+		const char* name;
+		glm::vec3 eye, target;
+	};
+	const camera_t cameras[] = {
+		{ "centre +x", { 0.f, 0.5f, 0.f }, { 1.f, 0.5f, 0.f } },
+		{ "centre -z", { 0.f, 0.5f, 0.f }, { 0.f, 0.5f, -1.f } },
+		{ "corner", { -4.f, 0.5f, -4.f }, { 0.f, 0.f, 0.f } },
+		{ "edge out", { 3.5f, 0.5f, 0.f }, { 5.f, 0.5f, 0.f } },
+		{ "above", { 0.f, 3.f, 0.f }, { 0.f, 0.f, 0.01f } },
+	};
+	printf("%-10s %16s %18s %14s %12s\n", "camera", "level chunks", "object instances", "draw calls", "cull (ms)");
+	for (const camera_t& camera : cameras)
+	{
+		const glm::mat4 viewProjection = glm::perspective(glm::pi<float>() * 0.25f, 16.f / 9.f, 0.1f, 100.f)
+			* glm::lookAt(camera.eye, camera.target, glm::vec3(0.f, 1.f, 0.f));
+		std::vector<double> times;
+		scenedrawcounts_t counts;
+		for (int run = 0; run < 5; ++run)
+		{
+			const auto start = clock_type::now();
+			CullBoxes(ExtractFrustum(glm::value_ptr(viewProjection)), candidates.bounds, visible.data());
+			counts = BuildSceneDraws(level.models, arena, candidates, visible.data(), instances, commands);
+			times.push_back(MillisecondsSince(start));
+		}
+		if (!CheckSceneDraws(level, arena, candidates, visible, instances, commands))
+		{
+			printf("Draws from %s do not match the visible candidates\n", camera.name);
+			ok = false;
+		}
+		for (size_t i = 0; i < candidates.drawables.size(); ++i)
+		{
+			const scenedrawable_t& drawable = candidates.drawables[i];
+			// Billboards turn with the camera, which the shader knows and this does not
+			if (!visible[i] && !billboards[drawable.model] && !IsOutsideClipPlane(*level.models[drawable.model], drawable, viewProjection))
+			{
+				printf("Model %08X chunk %u was culled from %s while on screen\n", level.models[drawable.model]->addr, drawable.chunk, camera.name);
+				ok = false;
+				break;
+			}
+		}
+		printf("%-10s %7zu / %-6zu %8zu / %-7zu %14zu %12.3f\n", camera.name, counts.levelChunksDrawn, counts.levelChunks, counts.objectInstancesDrawn,
+			counts.objectInstances, commands.size(), Median(times));
+	}
+	UnloadLevel(level);
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	const char* bench = argc > 1 ? argv[1] : "instances";
+	const std::filesystem::path dir = std::filesystem::temp_directory_path();
+
+	if (strcmp(bench, "instances") == 0)
+		return BenchInstances(dir) ? 0 : 1;
+	if (strcmp(bench, "cache") == 0)
+		return BenchCache(dir, argc > 2 ? argv[2] : nullptr) ? 0 : 1;
+	if (strcmp(bench, "stages") == 0)
+		return BenchStages(dir, argc - 2, argv + 2) ? 0 : 1;
+	if (strcmp(bench, "textures") == 0)
+		return BenchTextureDecoders() ? 0 : 1;
+	if (strcmp(bench, "packing") == 0)
+		return BenchPacking() ? 0 : 1;
+	if (strcmp(bench, "compress") == 0)
+		return BenchCompression(dir) ? 0 : 1;
+	if (strcmp(bench, "budget") == 0)
+		return BenchBudget(dir) ? 0 : 1;
+	if (strcmp(bench, "meshes") == 0)
+		return BenchMeshes(dir) ? 0 : 1;
+	if (strcmp(bench, "arena") == 0)
+		return BenchSceneArena(dir) ? 0 : 1;
+	if (strcmp(bench, "culling") == 0)
+		return BenchCulling(dir) ? 0 : 1;
+	if (strcmp(bench, "generate") == 0)
+		return GenerateLevel(argc - 2, argv + 2) ? 0 : 1;
+
+	printf("Usage: g2bench [instances | cache [level.dfx] | stages [options] | textures | packing | compress | budget | meshes | arena | culling | generate <out.dfx> [options]]\n");
+	printf("  stages options: --runs n, --baseline file, --write-baseline file, --tolerance fraction\n");
+	return 1;
+}
@@ -0,0 +1,190 @@
+#include "mapreader.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using clock_type = std::chrono::steady_clock;
+
+struct result_t
+{
+	std::string path;
+	bool loaded = false;
+	bool hasVfx = false;
+	bool fromCache = false;
+	double loadMs = 0;
+	size_t polygons = 0;
+	size_t textures = 0;
+	unsigned int atlasW = 0, atlasH = 0, atlasPages = 0;
+	BlockFormat_t atlasFormat = BlockFormat_t::None;
+	AtlasFormat_t texelFormat = AtlasFormat_t::RGBA8;
+	size_t degraded = 0;
+	meshstats_t meshes;
+	size_t atlasUsed = 0;
+};
+
+static bool HasExtension(const fs::path& path, const char* ext)
+{
+	std::string e = path.extension().string();
+	std::transform(e.begin(), e.end(), e.begin(), [](unsigned char c) { return (char)tolower(c); });
+	return e == ext;
+}
+
+static void ConvertLevel(result_t& result, const std::string& cacheDirectory, bool compress, size_t budget, ThreadPool& pool)
+{
+	fs::path vfx = fs::path(result.path).replace_extension(".vfx");
+	result.hasVfx = fs::exists(vfx);
+
+	level_t level;
+	loadoptions_t options;
+	options.verbose = false;
+	options.cacheDirectory = cacheDirectory;
+	options.compressAtlas = compress;
+	options.textureBudget = budget;
+	options.pool = &pool;
+
+	auto start = clock_type::now();
+	result.loaded = LoadLevel(result.path, level, options);
+	result.loadMs = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+
+	if (result.loaded)
+	{
+		// Skip the placeholder cube, it is not part of the level data
+		for (auto& model : level.models)
+			if (model->addr != 0)
+				result.polygons += model->mesh.GetTriangleCount();
+		result.textures = level.list.size();
+		result.fromCache = level.fromCache;
+		result.meshes = level.meshStats;
+		result.atlasW = level.sheet.w;
+		result.atlasH = level.sheet.h;
+		result.atlasPages = level.sheetPages;
+		result.atlasFormat = level.compressedFormat;
+		result.texelFormat = level.atlasFormat;
+		result.degraded = level.degradedTextures.size();
+		for (auto& info : level.list)
+			result.atlasUsed += (size_t)info.width * info.height;
+	}
+
+	UnloadLevel(level);
+}
+
+static void PrintUsage()
+{
+	printf("Usage: g2convert <directory> [-j threads] [--cache dir] [--compress] [--budget MB]\n");
+	printf("  Loads every .dfx/.vfx pair under <directory> and reports load statistics.\n");
+	printf("  --cache cooks each level into <dir>, or loads it from there when up to date.\n");
+	printf("  --compress also block compresses each atlas to BC1, or BC3 when it has alpha.\n");
+	printf("  --budget limits each atlas to MB megabytes on the GPU, downscaling textures to fit.\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* directory = nullptr;
+	unsigned int threads = 0;
+	std::string cacheDirectory;
+	bool compress = false;
+	size_t budget = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threads = (unsigned int)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+			cacheDirectory = argv[++i];
+		else if (strcmp(argv[i], "--compress") == 0)
+			compress = true;
+		else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+			budget = (size_t)atoi(argv[++i]) * 1024 * 1024;
+		else if (argv[i][0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else
+			directory = argv[i];
+	}
+
+	if (!directory || !fs::is_directory(directory))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	std::vector<result_t> results;
+	for (auto& entry : fs::recursive_directory_iterator(directory))
+	{
+		if (entry.is_regular_file() && HasExtension(entry.path(), ".dfx"))
+		{
+			result_t result;
+			result.path = entry.path().string();
+			results.push_back(result);
+		}
+	}
+	std::sort(results.begin(), results.end(), [](const result_t& a, const result_t& b) { return a.path < b.path; });
+
+	if (results.empty())
+	{
+		printf("No .dfx files found under %s\n", directory);
+		return 1;
+	}
+
+	// -j counts the calling thread, same as the shared pool. The levels and
+	// the loads inside them share it, so -j 1 runs everything serially.
+	std::unique_ptr<ThreadPool> ownPool;
+	if (threads != 0)
+		ownPool = std::make_unique<ThreadPool>(threads > 1 ? threads - 1 : ThreadPool::c_CALLERONLY);
+	ThreadPool& pool = ownPool ? *ownPool : ThreadPool::Get();
+
+	printf("Processing %zu levels on %u threads\n", results.size(), pool.GetConcurrency());
+	auto start = clock_type::now();
+	pool.ParallelFor(results.size(), [&](size_t i) { ConvertLevel(results[i], cacheDirectory, compress, budget, pool); });
+	double wallMs = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+
+	printf("\n%-40s %10s %10s %9s %19s %17s %10s\n", "level", "load (ms)", "polygons", "textures", "atlas", "mesh MB (before)", "mesh (ms)");
+	double totalMs = 0;
+	size_t failed = 0;
+	for (auto& r : results)
+	{
+		std::string name = fs::relative(r.path, directory).string();
+		if (!r.loaded)
+		{
+			printf("%-40s %10s\n", name.c_str(), "FAILED");
+			++failed;
+			continue;
+		}
+
+		char atlas[32] = "-";
+		if (r.atlasW != 0)
+		{
+			const double used = r.atlasUsed * 100.0 / ((double)r.atlasW * r.atlasH * r.atlasPages);
+			if (r.atlasPages > 1)
+				snprintf(atlas, sizeof(atlas), "%ux%ux%u (%.0f%%)", r.atlasW, r.atlasH, r.atlasPages, used);
+			else
+				snprintf(atlas, sizeof(atlas), "%ux%u (%.0f%%)", r.atlasW, r.atlasH, used);
+		}
+		char format[48] = "";
+		if (r.atlasFormat != BlockFormat_t::None)
+			snprintf(format, sizeof(format), "  %s", GetBlockFormatName(r.atlasFormat));
+		else if (r.texelFormat != AtlasFormat_t::RGBA8)
+			snprintf(format, sizeof(format), "  %s", GetAtlasFormatName(r.texelFormat));
+		if (r.degraded != 0)
+			snprintf(format + strlen(format), sizeof(format) - strlen(format), "  (%zu downscaled)", r.degraded);
+		char meshes[32];
+		snprintf(meshes, sizeof(meshes), "%.2f (%.2f)", r.meshes.GetBytes() / (1024.0 * 1024.0), r.meshes.GetExpandedBytes() / (1024.0 * 1024.0));
+		char meshMs[16] = "-";
+		if (!r.fromCache)
+			snprintf(meshMs, sizeof(meshMs), "%.2f", r.meshes.buildMs);
+		printf("%-40s %10.2f %10zu %9zu %19s %17s %10s%s%s%s\n", name.c_str(), r.loadMs, r.polygons, r.textures, atlas, meshes, meshMs, format, r.hasVfx ? "" : "  (no .vfx)", r.fromCache ? "  (cached)" : "");
+		totalMs += r.loadMs;
+	}
+
+	printf("\n%zu levels, %zu failed, %.2f ms summed load time, %.2f ms wall time\n", results.size(), failed, totalMs, wallMs);
+	return failed == 0 ? 0 : 1;
+}
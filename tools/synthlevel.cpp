@@ -0,0 +1,240 @@
+#include "synthlevel.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+using byte = unsigned char;
+using u16 = unsigned short;
+using u32 = unsigned int;
+using i16 = signed short;
+
+// Little endian writer over a growable buffer
+struct writer_t
+{
+	std::vector<byte> data;
+
+	template<typename T>
+	void Put(size_t offset, T value)
+	{
+		if (offset + sizeof(T) > data.size())
+			data.resize(offset + sizeof(T));
+		for (size_t i = 0; i < sizeof(T); ++i)
+			data[offset + i] = (byte)((unsigned long long)value >> (i * 8));
+	}
+
+	void PutName(size_t offset, const char* name)
+	{
+		for (size_t i = 0; i < 8; ++i)
+			Put<byte>(offset + i, (byte)(name[i] ? name[i] : '_'));
+	}
+
+	// Reserves `size` bytes at the end of the buffer and returns their offset
+	size_t Alloc(size_t size, size_t align = 4)
+	{
+		size_t offset = (data.size() + align - 1) / align * align;
+		data.resize(offset + size);
+		return offset;
+	}
+};
+
+static bool WriteBuffer(const std::string& path, const std::vector<byte>& data)
+{
+	if (FILE* f = fopen(path.c_str(), "wb"))
+	{
+		bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+		fclose(f);
+		return ok;
+	}
+
+	return false;
+}
+
+// Glide enum values, see glideconstants.h
+constexpr u32 c_TEXFMT_YIQ_422 = 0x1;
+constexpr u32 c_TEXFMT_ARGB_1555 = 0xB;
+constexpr u32 c_TEXFMT_ARGB_4444 = 0xC;
+constexpr u32 c_VFXHEADERSIZE = 0x8C;
+
+static std::vector<byte> BuildTextures(std::mt19937& rng, unsigned int count)
+{
+	const u32 formats[] = { c_TEXFMT_ARGB_4444, c_TEXFMT_ARGB_1555, c_TEXFMT_YIQ_422 };
+	writer_t vfx;
+	vfx.Put<u32>(0, count);
+	for (u32 i = 0; i < count; ++i)
+	{
+		// LOD 128 down to 16 over every aspect ratio, every fourth texture with
+		// two smaller levels stored after the large one
+		const u32 lod = 1 + rng() % 4;
+		const u32 smallLod = i % 4 == 3 ? lod + 2 : lod;
+		const u32 aspect = rng() % 7;
+		const u32 format = formats[i % 3];
+		const u32 texelSize = format == c_TEXFMT_YIQ_422 ? 1 : 2;
+		u32 bytes = 0;
+		for (u32 level = lod; level <= smallLod; ++level)
+		{
+			const u32 side = 256u >> level;
+			const u32 w = aspect > 3 ? side >> (aspect - 3) : side;
+			const u32 h = aspect < 3 ? side >> (3 - aspect) : side;
+			bytes += std::max(w, 1u) * std::max(h, 1u) * texelSize;
+		}
+		// Keeps every record a multiple of 4 bytes
+		const u32 paddedBytes = (bytes + 3) & ~3u;
+
+		const size_t header = vfx.Alloc(c_VFXHEADERSIZE + paddedBytes, 1);
+		vfx.Put<u32>(header + 0x00, smallLod);
+		vfx.Put<u32>(header + 0x04, lod);
+		vfx.Put<u32>(header + 0x08, aspect);
+		vfx.Put<u32>(header + 0x0C, format);
+		for (size_t j = 0; j < 16; ++j)
+			vfx.Put<byte>(header + 0x14 + j, (byte)(j * 16 + rng() % 16));
+		// I and Q are 9-bit signed
+		for (size_t j = 0; j < 24; ++j)
+			vfx.Put<i16>(header + 0x24 + j * 2, (i16)(rng() % 0x200));
+		vfx.Put<u32>(header + 0x84, 0);
+		vfx.Put<u32>(header + 0x88, paddedBytes);
+
+		for (size_t j = 0; j < paddedBytes; j += 4)
+			vfx.Put<u32>(header + c_VFXHEADERSIZE + j, (u32)rng());
+	}
+
+	return vfx.data;
+}
+
+// Writes `vertexCount` vertices and `polygonCount` polygons, returns the
+// vertex and polygon table addresses
+static std::pair<size_t, size_t> BuildGeometry(writer_t& data, std::mt19937& rng, u32 vertexCount, u32 polygonCount, bool isLevel, const std::vector<u32>& materials)
+{
+	const size_t vertices = data.Alloc(12 * (size_t)vertexCount);
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		const size_t v = vertices + 12 * (size_t)i;
+		for (size_t j = 0; j < 3; ++j)
+			data.Put<i16>(v + j * 2, (i16)(rng() % 8192 - 4096));
+		data.Put<u32>(v + 8, rng() | 0xFF000000);
+	}
+
+	const size_t stride = isLevel ? 0x14 : 0x0C;
+	const size_t polygons = data.Alloc(stride * polygonCount);
+	for (u32 i = 0; i < polygonCount; ++i)
+	{
+		const size_t p = polygons + stride * i;
+		for (size_t j = 0; j < 3; ++j)
+			data.Put<u16>(p + j * 2, (u16)(rng() % vertexCount));
+
+		const u32 material = materials.empty() ? 0xFFFF : materials[rng() % materials.size()];
+		if (isLevel)
+			data.Put<u32>(p + 0x10, material);
+		else if (!materials.empty())
+		{
+			data.Put<byte>(p + 7, 0x02);
+			data.Put<u32>(p + 8, material);
+		}
+	}
+
+	return { vertices, polygons };
+}
+
+// Polygons index vertices with 16 bits
+static u32 ClampVertexCount(u32 vertexCount, u32 polygonCount)
+{
+	vertexCount = std::min(vertexCount, 0x10000u);
+	return polygonCount != 0 ? std::max(vertexCount, 3u) : vertexCount;
+}
+
+bool WriteSyntheticLevel(const std::string& dfxPath, const synthleveloptions_t& options)
+{
+	std::mt19937 rng(options.seed);
+	writer_t dfx;
+
+	// A raw header value of 0 puts the data block at 0x800
+	constexpr u32 c_DATAOFFSET = 0x800;
+	dfx.Put<u32>(0, 0);
+	dfx.data.resize(c_DATAOFFSET);
+
+	// Everything below is addressed relative to the data block
+	writer_t data;
+	const size_t header = data.Alloc(0x100);
+	data.PutName(header + 0xE0, "synth___");
+
+	// Material records: uv pairs at 0, 4 and 8, texture id at 6
+	std::vector<u32> materials;
+	for (u32 i = 0; i < options.materialCount; ++i)
+	{
+		const size_t material = data.Alloc(12);
+		for (size_t j = 0; j < 3; ++j)
+		{
+			data.Put<byte>(material + j * 4 + 0, (byte)rng());
+			data.Put<byte>(material + j * 4 + 1, (byte)rng());
+		}
+		data.Put<u16>(material + 6, (u16)(options.textureCount != 0 ? i % options.textureCount : i % 0x1000));
+		materials.push_back((u32)material);
+	}
+
+	const u32 levelVertices = ClampVertexCount(options.levelVertexCount, options.levelPolygonCount);
+	const size_t geometry = data.Alloc(0x34);
+	auto [vertices, polygons] = BuildGeometry(data, rng, levelVertices, options.levelPolygonCount, true, materials);
+	data.Put<u32>(header + 0x00, (u32)geometry);
+	data.Put<u32>(geometry + 0x18, levelVertices);
+	data.Put<u32>(geometry + 0x1C, options.levelPolygonCount);
+	data.Put<u32>(geometry + 0x24, (u32)vertices);
+	data.Put<u32>(geometry + 0x28, (u32)polygons);
+
+	// Object headers store 16-bit counts
+	const u32 objectVertices = std::min(ClampVertexCount(options.objectVertexCount, options.objectPolygonCount), 0xFFFFu);
+	const u32 objectPolygons = std::min(options.objectPolygonCount, 0xFFFFu);
+	std::vector<u32> modelAddrs;
+	for (u32 i = 0; i < options.modelCount; ++i)
+	{
+		// Names hold 8 characters, past 99999 models they repeat
+		char name[9];
+		snprintf(name, sizeof(name), "obj%05u", i % 100000);
+		const size_t nameAddr = data.Alloc(8);
+		data.PutName(nameAddr, name);
+
+		const size_t model = data.Alloc(0x28);
+		data.Put<u32>(model + 0x24, (u32)nameAddr);
+		modelAddrs.push_back((u32)model);
+		if (options.objectPolygonCount == 0)
+		{
+			data.Put<u16>(model + 8, 0);
+			data.Put<u32>(model + 12, (u32)model);
+			continue;
+		}
+
+		// One object: a table of geometry addresses, then the geometry header
+		const size_t table = data.Alloc(4);
+		const size_t object = data.Alloc(0x24);
+		auto [objVertices, objPolygons] = BuildGeometry(data, rng, objectVertices, objectPolygons, false, materials);
+		data.Put<u16>(model + 8, 1);
+		data.Put<u32>(model + 12, (u32)table);
+		data.Put<u32>(table, (u32)object);
+		data.Put<u16>(object + 0, (u16)objectVertices);
+		data.Put<u32>(object + 4, (u32)objVertices);
+		data.Put<u16>(object + 16, (u16)objectPolygons);
+		data.Put<u32>(object + 20, (u32)objPolygons);
+	}
+
+	const size_t instances = data.Alloc(0x30 * (size_t)options.instanceCount);
+	data.Put<u32>(header + 0x78, options.instanceCount);
+	data.Put<u32>(header + 0x7C, (u32)instances);
+	for (u32 i = 0; i < options.instanceCount && !modelAddrs.empty(); ++i)
+	{
+		const size_t inst = instances + 0x30 * (size_t)i;
+		data.Put<u32>(inst + 0, modelAddrs[rng() % modelAddrs.size()]);
+		for (size_t j = 0; j < 6; ++j)
+			data.Put<i16>(inst + 10 + j * 2, (i16)(rng() % 4096 - 2048));
+	}
+
+	dfx.data.insert(dfx.data.end(), data.data.begin(), data.data.end());
+	if (!WriteBuffer(dfxPath, dfx.data))
+		return false;
+
+	if (options.textureCount == 0)
+		return true;
+
+	const std::string vfxPath = dfxPath.substr(0, dfxPath.find_last_of('.')) + ".vfx";
+	return WriteBuffer(vfxPath, BuildTextures(rng, options.textureCount));
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+
+// Generates .dfx/.vfx pairs in the layout LoadLevel expects, so the loader can
+// be measured without shipping game data.
+struct synthleveloptions_t
+{
+	unsigned int modelCount = 16;
+	unsigned int instanceCount = 1000;
+	unsigned int levelVertexCount = 0;
+	unsigned int levelPolygonCount = 0;
+	// Geometry of every model, models without polygons are empty
+	unsigned int objectVertexCount = 0;
+	unsigned int objectPolygonCount = 0;
+	// Material records shared by level and object polygons, 0 leaves every
+	// polygon untextured
+	unsigned int materialCount = 0;
+	// Textures cycle through ARGB4444, ARGB1555 and YIQ422. A .vfx is only
+	// written when this is non-zero.
+	unsigned int textureCount = 0;
+	unsigned int seed = 1;
+};
+
+// Writes `dfxPath` and, with textures, the .vfx next to it
+bool WriteSyntheticLevel(const std::string& dfxPath, const synthleveloptions_t& options);